@@ -0,0 +1,391 @@
+; 2048 driven by the keys w, a, s and d on the input. Every key prints the board as
+; one line, a tile per character: '.' for empty, 1 for 2, 2 for 4 up to B for 2048.
+; A move that changes the board spawns a 2 in the first empty cell at or after a
+; pseudo random one. A lost game starts over. Prints moves, merges and games at end
+; of input
+.ORIG x3000
+        JSR SPAWN
+        JSR SPAWN
+KEY     GETC
+        ADD R0, R0, #0
+        BRn FINISH
+        LD R1, UPP
+        LD R2, KEY_W
+        ADD R2, R0, R2
+        BRz DO_MOVE
+        LD R1, LEFTP
+        LD R2, KEY_A
+        ADD R2, R0, R2
+        BRz DO_MOVE
+        LD R1, DOWNP
+        LD R2, KEY_S
+        ADD R2, R0, R2
+        BRz DO_MOVE
+        LD R1, RIGHTP
+        LD R2, KEY_D
+        ADD R2, R0, R2
+        BRnp KEY                ; Not a move
+DO_MOVE JSR MOVE
+        ADD R5, R5, #0
+        BRnp MOVED
+        JSR CANMOVE
+        ADD R5, R5, #0
+        BRnp SHOW
+        JSR RESTART
+        BR SHOW
+MOVED   LD R0, MOVES
+        ADD R0, R0, #1
+        ST R0, MOVES
+        JSR SPAWN
+SHOW    JSR RENDER
+        BR KEY
+
+FINISH  LEA R0, S_MOVES
+        PUTS
+        LD R0, MOVES
+        JSR PRINTNUM
+        LEA R0, S_MERGE
+        PUTS
+        LD R0, MERGES
+        JSR PRINTNUM
+        LEA R0, S_GAMES
+        PUTS
+        LD R0, GAMES
+        JSR PRINTNUM
+        LD R0, NL
+        OUT
+        HALT
+KEY_W   .FILL #-119
+KEY_A   .FILL #-97
+KEY_S   .FILL #-115
+KEY_D   .FILL #-100
+MOVES   .FILL #0
+MERGES  .FILL #0
+NL      .FILL x0A
+S_MOVES .STRINGZ "moves "
+GAMES   .FILL #1
+S_MERGE .STRINGZ " merges "
+S_GAMES .STRINGZ " games "
+BOARDP  .FILL BOARD
+UPP     .FILL UP
+DOWNP   .FILL DOWN
+LEFTP   .FILL LEFT
+RIGHTP  .FILL RIGHT
+RND     .FILL #2048
+
+; Slide and merge the four lines listed in the table at R1, cells in the order they
+; move toward. R5 = 1 when a tile moved
+MOVE    ST R7, MV_R7
+        AND R5, R5, #0
+        AND R2, R2, #0
+        ADD R2, R2, #4          ; Lines left
+
+MV_LINE LEA R3, LV              ; Copy the line to LV and clear LO
+        AND R4, R4, #0
+        ADD R4, R4, #4
+MV_LD   LDR R0, R1, #0
+        LD R6, BOARDP
+        ADD R6, R6, R0
+        LDR R0, R6, #0
+        STR R0, R3, #0
+        AND R0, R0, #0
+        STR R0, R3, #4
+        ADD R1, R1, #1
+        ADD R3, R3, #1
+        ADD R4, R4, #-1
+        BRp MV_LD
+        ADD R1, R1, #-4
+
+        LEA R3, LV              ; Tiles read
+        LEA R4, LO              ; Tiles written
+        AND R6, R6, #0          ; Last tile written if it may still merge
+        AND R7, R7, #0
+        ADD R7, R7, #4
+MV_MG   LDR R0, R3, #0
+        BRz MV_NX
+        NOT R0, R0
+        ADD R0, R0, #1
+        ADD R0, R6, R0
+        BRnp MV_PUT
+        ADD R6, R6, #1          ; Merge into the last tile written
+        ADD R4, R4, #-1
+        STR R6, R4, #0
+        ADD R4, R4, #1
+        AND R6, R6, #0
+        LD R0, MERGES
+        ADD R0, R0, #1
+        ST R0, MERGES
+        BR MV_NX
+MV_PUT  LDR R0, R3, #0
+        STR R0, R4, #0
+        ADD R4, R4, #1
+        ADD R6, R0, #0
+MV_NX   ADD R3, R3, #1
+        ADD R7, R7, #-1
+        BRp MV_MG
+
+        LEA R3, LV              ; Write LO back
+        AND R7, R7, #0
+        ADD R7, R7, #4
+MV_WB   LDR R0, R3, #4
+        LDR R4, R3, #0
+        NOT R4, R4
+        ADD R4, R4, #1
+        ADD R4, R0, R4
+        BRz MV_SAME
+        AND R5, R5, #0
+        ADD R5, R5, #1
+MV_SAME LDR R4, R1, #0
+        LD R6, BOARDP
+        ADD R6, R6, R4
+        STR R0, R6, #0
+        ADD R1, R1, #1
+        ADD R3, R3, #1
+        ADD R7, R7, #-1
+        BRp MV_WB
+
+        ADD R2, R2, #-1
+        BRp MV_LINE
+        LD R7, MV_R7
+        RET
+MV_R7   .BLKW 1
+LV      .BLKW 4
+LO      .BLKW 4
+
+; R5 = 1 unless the board is full and no two neighbours are equal
+CANMOVE ST R7, CM_R7
+        AND R5, R5, #0
+        ADD R5, R5, #1
+        LD R1, LEFTP            ; Rows, then the columns right after in UP
+        JSR CM_TAB
+        LD R1, UPP
+        JSR CM_TAB
+        AND R5, R5, #0
+        LD R7, CM_R7
+        RET
+CM_R7   .BLKW 1
+
+; Return to CANMOVE's caller with R5 = 1 if a line of the table at R1 can move
+CM_TAB  ST R7, CT_R7
+        AND R2, R2, #0
+        ADD R2, R2, #4
+CT_LINE AND R3, R3, #0
+        ADD R3, R3, #3          ; Pairs per line
+        LDR R0, R1, #0
+        LD R4, BOARDP
+        ADD R4, R4, R0
+        LDR R6, R4, #0          ; Left of the pair
+        BRz CT_YES
+CT_PAIR ADD R1, R1, #1
+        LDR R0, R1, #0
+        LD R4, BOARDP
+        ADD R4, R4, R0
+        LDR R4, R4, #0          ; Right of the pair
+        BRz CT_YES
+        NOT R0, R4
+        ADD R0, R0, #1
+        ADD R0, R6, R0
+        BRz CT_YES
+        ADD R6, R4, #0
+        ADD R3, R3, #-1
+        BRp CT_PAIR
+        ADD R1, R1, #1
+        ADD R2, R2, #-1
+        BRp CT_LINE
+        LD R7, CT_R7
+        RET
+CT_YES  LD R7, CM_R7            ; Skip the rest of CANMOVE
+        RET
+CT_R7   .BLKW 1
+
+; Clear the board for a new game
+RESTART ST R7, RS_R7
+        LD R1, BOARDP
+        AND R0, R0, #0
+        AND R2, R2, #0
+        ADD R2, R2, #8
+        ADD R2, R2, #8
+RS_LP   STR R0, R1, #0
+        ADD R1, R1, #1
+        ADD R2, R2, #-1
+        BRp RS_LP
+        LD R0, GAMES
+        ADD R0, R0, #1
+        ST R0, GAMES
+        JSR SPAWN
+        JSR SPAWN
+        LD R7, RS_R7
+        RET
+RS_R7   .BLKW 1
+
+; Put a 2 in the first empty cell at or after a pseudo random one
+SPAWN   LD R0, RND
+        ADD R1, R0, R0
+        ADD R1, R1, R1
+        ADD R0, R1, R0
+        ADD R0, R0, #3
+        ST R0, RND
+        AND R2, R0, #15
+        AND R3, R3, #0
+        ADD R3, R3, #8
+        ADD R3, R3, #8
+SP_LP   LD R1, BOARDP
+        ADD R1, R1, R2
+        LDR R0, R1, #0
+        BRz SP_PUT
+        ADD R2, R2, #1
+        AND R2, R2, #15
+        ADD R3, R3, #-1
+        BRp SP_LP
+        RET
+SP_PUT  AND R0, R0, #0
+        ADD R0, R0, #1
+        STR R0, R1, #0
+        RET
+
+; Print the board as one line
+RENDER  ST R7, RD_R7
+        LD R1, BOARDP
+        LEA R2, LINE
+        AND R3, R3, #0
+        ADD R3, R3, #8
+        ADD R3, R3, #8
+RD_LP   LDR R0, R1, #0
+        LEA R4, TILES
+        ADD R4, R4, R0
+        LDR R0, R4, #0
+        STR R0, R2, #0
+        ADD R1, R1, #1
+        ADD R2, R2, #1
+        ADD R3, R3, #-1
+        BRp RD_LP
+        LEA R0, LINE
+        PUTS
+        LD R7, RD_R7
+        RET
+RD_R7   .BLKW 1
+TILES   .STRINGZ ".123456789ABCDEF"
+LINE    .STRINGZ "................\n"
+
+BOARD   .BLKW 16
+UP      .FILL #0
+        .FILL #4
+        .FILL #8
+        .FILL #12
+        .FILL #1
+        .FILL #5
+        .FILL #9
+        .FILL #13
+        .FILL #2
+        .FILL #6
+        .FILL #10
+        .FILL #14
+        .FILL #3
+        .FILL #7
+        .FILL #11
+        .FILL #15
+DOWN    .FILL #12
+        .FILL #8
+        .FILL #4
+        .FILL #0
+        .FILL #13
+        .FILL #9
+        .FILL #5
+        .FILL #1
+        .FILL #14
+        .FILL #10
+        .FILL #6
+        .FILL #2
+        .FILL #15
+        .FILL #11
+        .FILL #7
+        .FILL #3
+LEFT    .FILL #0
+        .FILL #1
+        .FILL #2
+        .FILL #3
+        .FILL #4
+        .FILL #5
+        .FILL #6
+        .FILL #7
+        .FILL #8
+        .FILL #9
+        .FILL #10
+        .FILL #11
+        .FILL #12
+        .FILL #13
+        .FILL #14
+        .FILL #15
+RIGHT   .FILL #3
+        .FILL #2
+        .FILL #1
+        .FILL #0
+        .FILL #7
+        .FILL #6
+        .FILL #5
+        .FILL #4
+        .FILL #11
+        .FILL #10
+        .FILL #9
+        .FILL #8
+        .FILL #15
+        .FILL #14
+        .FILL #13
+        .FILL #12
+
+; Print R0 (0 to 32767) in decimal. Preserves all registers but R7
+PRINTNUM ST R0, PN_R0
+        ST R1, PN_R1
+        ST R2, PN_R2
+        ST R3, PN_R3
+        ST R4, PN_R4
+        ST R5, PN_R5
+        ST R7, PN_R7
+        ADD R1, R0, #0          ; Value left to print
+        LEA R2, PN_POW          ; Next negated power of ten
+        AND R4, R4, #0          ; Sum of the digits printed so far
+PN_NEXT LDR R3, R2, #0
+        BRz PN_END
+        AND R0, R0, #0          ; Digit
+PN_SUB  ADD R1, R1, R3
+        BRn PN_BACK
+        ADD R0, R0, #1
+        BR PN_SUB
+PN_BACK NOT R3, R3
+        ADD R3, R3, #1
+        ADD R1, R1, R3          ; Undo the last subtraction
+        ADD R5, R4, R0
+        BRz PN_SKIP             ; Leading zero
+        ADD R4, R5, #0
+        LD R5, PN_ZERO
+        ADD R0, R0, R5
+        OUT
+PN_SKIP ADD R2, R2, #1
+        BR PN_NEXT
+PN_END  ADD R4, R4, #0
+        BRnp PN_RET
+        LD R0, PN_ZERO
+        OUT
+PN_RET  LD R0, PN_R0
+        LD R1, PN_R1
+        LD R2, PN_R2
+        LD R3, PN_R3
+        LD R4, PN_R4
+        LD R5, PN_R5
+        LD R7, PN_R7
+        RET
+PN_POW  .FILL #-10000
+        .FILL #-1000
+        .FILL #-100
+        .FILL #-10
+        .FILL #-1
+        .FILL #0
+PN_ZERO .FILL x30
+PN_R0   .BLKW 1
+PN_R1   .BLKW 1
+PN_R2   .BLKW 1
+PN_R3   .BLKW 1
+PN_R4   .BLKW 1
+PN_R5   .BLKW 1
+PN_R7   .BLKW 1
+.END
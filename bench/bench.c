@@ -0,0 +1,485 @@
+// Guest workload benchmarks, run by `make bench`
+//
+//   bench [-n reps] [-d dir] [-j out.json] [-c baseline.json] [-t percent] [workload ..]
+//
+// Every workload is an LC-3 image in dir (default bench), assembled from the .asm
+// next to it, with fixed input from a .txt of the same name when there is one. The
+// images run in this process, reading input from memory and collecting output in
+// memory, so the numbers measure the interpreter and not a terminal. Every run is
+// checked against a hash of the expected output, a fast wrong answer is no result.
+//
+// -j writes the results and a description of the host as JSON, one result object
+// per line, with the time of every run. -c compares this run against such a file
+// and exits with status 1 when a workload got slower by more than the noise of both
+// runs explains and by more than -t percent (default 2), see compare_results()
+#include <math.h>
+#include <sys/utsname.h>
+
+#define LC3_NO_MAIN
+#include "../src/vm.c"
+#include "engines.h"
+
+enum
+{
+    BENCH_REPS = 10,
+    MAX_RESULTS = 64,
+    BENCH_THRESHOLD = 2, // percent
+};
+
+struct workload
+{
+    const char *name;
+    uint64_t output_hash; // FNV-1a of the complete output, HALT included
+};
+
+const struct workload workloads[] = {
+    {"fib", 0x2806df53bb98e5a2ULL},
+    {"sieve", 0xbf386cf8f3b668e4ULL},
+    {"bubble", 0x053be904072ecd35ULL},
+    {"insertion", 0x053be904072ecd35ULL},
+    {"strrev", 0x5e1efbd5f9965b89ULL},
+    {"muldiv", 0x53607ddafde47a40ULL},
+    {"2048", 0xf4c0d1e8b905eadcULL},
+};
+
+enum
+{
+    WORKLOAD_COUNT = sizeof(workloads) / sizeof(workloads[0])
+};
+
+// One run of a workload
+struct run
+{
+    int status;
+    uint64_t instructions;
+    double seconds;
+    uint64_t output_hash;
+};
+
+// All runs of a workload on an engine, from this process or from a baseline file
+struct result
+{
+    char workload[32];
+    char engine[32];
+    uint64_t instructions;
+    int runs;
+    double *ns; // ns per instruction of every run
+    double mean, stddev, min;
+};
+
+uint64_t fnv1a(const uint8_t *data, size_t len)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ data[i]) * 0x100000001b3ULL;
+    return h;
+}
+
+// Load and run image path on a fresh machine. Only the engine is timed
+int run_image(const char *path, const struct engine *e, const uint8_t *input, size_t input_len, struct run *r)
+{
+    vm_reset();
+    if (!read_image(path))
+        return 0;
+
+    console_input_buffer(input, input_len);
+    console_output_buffer();
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    r->status = e->run();
+    r->seconds = elapsed_since(start);
+    r->instructions = instret;
+
+    size_t len;
+    const uint8_t *output = console_output(&len);
+    r->output_hash = fnv1a(output, len);
+    console_close();
+    return 1;
+}
+
+void summarize(struct result *res)
+{
+    double sum = 0;
+    res->min = HUGE_VAL;
+    for (int i = 0; i < res->runs; i++)
+    {
+        sum += res->ns[i];
+        if (res->ns[i] < res->min)
+            res->min = res->ns[i];
+    }
+    res->mean = sum / res->runs;
+
+    double var = 0;
+    for (int i = 0; i < res->runs; i++)
+        var += (res->ns[i] - res->mean) * (res->ns[i] - res->mean);
+    res->stddev = res->runs > 1 ? sqrt(var / (res->runs - 1)) : 0;
+}
+
+// Run workload w reps times on engine e and print its line
+int bench_workload(const char *dir, const struct workload *w, const struct engine *e, int reps, struct result *res)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s.txt", dir, w->name);
+    size_t input_len;
+    uint8_t *input = read_file(path, &input_len);
+    snprintf(path, sizeof(path), "%s/%s.obj", dir, w->name);
+
+    snprintf(res->workload, sizeof(res->workload), "%s", w->name);
+    snprintf(res->engine, sizeof(res->engine), "%s", e->name);
+    res->runs = reps;
+    res->ns = malloc(reps * sizeof(*res->ns));
+
+    // The first run warms caches and the branch predictor and is not counted
+    struct run r;
+    for (int i = -1; i < reps; i++)
+    {
+        if (!run_image(path, e, input, input_len, &r))
+        {
+            printf("%-12s %-8s failed to load image: %s\n", w->name, e->name, path);
+            free(input);
+            free(res->ns);
+            return 0;
+        }
+        if (r.status != VM_HALTED || r.output_hash != w->output_hash)
+        {
+            printf("%-12s %-8s bad result: status %d, output hash 0x%016llx\n", w->name, e->name, r.status,
+                   (unsigned long long)r.output_hash);
+            free(input);
+            free(res->ns);
+            return 0;
+        }
+        if (i >= 0)
+            res->ns[i] = r.seconds * 1e9 / r.instructions;
+    }
+    free(input);
+
+    res->instructions = r.instructions;
+    summarize(res);
+    printf("%-12s %-8s %14llu %10.3f %10.3f %8.2f%% %10.2f\n", w->name, e->name, (unsigned long long)r.instructions,
+           res->mean * r.instructions / 1e6, res->min * r.instructions / 1e6, 100 * res->stddev / res->mean,
+           1e3 / res->mean);
+    return 1;
+}
+
+// Model name of the first CPU in /proc/cpuinfo
+void cpu_model(char *buf, size_t size)
+{
+    snprintf(buf, size, "unknown");
+    FILE *file = fopen("/proc/cpuinfo", "r");
+    if (!file)
+        return;
+
+    char line[256];
+    while (fgets(line, sizeof(line), file))
+    {
+        char *colon = strchr(line, ':');
+        if (strncmp(line, "model name", 10) == 0 && colon)
+        {
+            snprintf(buf, size, "%s", colon + 2);
+            buf[strcspn(buf, "\n")] = 0;
+            break;
+        }
+    }
+    fclose(file);
+}
+
+// Write s as a JSON string
+void json_string(FILE *file, const char *s)
+{
+    fputc('"', file);
+    for (; *s; s++)
+    {
+        if (*s == '"' || *s == '\\')
+            fprintf(file, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            fprintf(file, "\\u%04x", *s);
+        else
+            fputc(*s, file);
+    }
+    fputc('"', file);
+}
+
+int write_json(const char *path, const struct result *results, int count, int reps)
+{
+    FILE *file = fopen(path, "w");
+    if (!file)
+        return 0;
+
+    struct utsname u;
+    uname(&u);
+    char cpu[128];
+    cpu_model(cpu, sizeof(cpu));
+
+    fprintf(file, "{\n  \"host\": {\"hostname\": ");
+    json_string(file, u.nodename);
+    fprintf(file, ", \"os\": ");
+    json_string(file, u.sysname);
+    fprintf(file, ", \"kernel\": ");
+    json_string(file, u.release);
+    fprintf(file, ", \"arch\": ");
+    json_string(file, u.machine);
+    fprintf(file, ", \"cpu\": ");
+    json_string(file, cpu);
+    fprintf(file, ", \"cpus\": %ld, \"compiler\": ", sysconf(_SC_NPROCESSORS_ONLN));
+    json_string(file, __VERSION__);
+    fprintf(file, ", \"time\": %lld},\n", (long long)time(NULL));
+    fprintf(file, "  \"reps\": %d,\n  \"results\": [\n", reps);
+
+    for (int i = 0; i < count; i++)
+    {
+        const struct result *res = &results[i];
+        fprintf(file, "    {\"workload\": ");
+        json_string(file, res->workload);
+        fprintf(file, ", \"engine\": ");
+        json_string(file, res->engine);
+        fprintf(file,
+                ", \"instructions\": %llu, \"runs\": %d, \"ns_per_instr\": %.4f, \"ns_per_instr_stddev\": %.4f, "
+                "\"ns_per_instr_min\": %.4f, \"mips\": %.3f, \"samples\": [",
+                (unsigned long long)res->instructions, res->runs, res->mean, res->stddev, res->min, 1e3 / res->mean);
+        for (int j = 0; j < res->runs; j++)
+            fprintf(file, "%s%.4f", j ? ", " : "", res->ns[j]);
+        fprintf(file, "]}%s\n", i + 1 < count ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    return fclose(file) == 0;
+}
+
+// Value of "key" in the JSON object starting at obj, copied as text up to the next
+// delimiter. Good for the flat objects write_json produces, not for JSON at large
+const char *json_field(const char *obj, const char *key, char *buf, size_t size)
+{
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    const char *p = strstr(obj, pattern);
+    const char *end = strchr(obj, '}');
+    if (!p || (end && p > end))
+        return NULL;
+
+    p += strlen(pattern);
+    while (*p == ' ')
+        p++;
+    if (*p == '"')
+        p++;
+
+    size_t n = strcspn(p, "\",}\n");
+    if (n >= size)
+        n = size - 1;
+    memcpy(buf, p, n);
+    buf[n] = 0;
+    return p;
+}
+
+// Read the results of a file written by write_json. Returns their count or -1
+int read_json(const char *path, struct result *results, int max)
+{
+    size_t len;
+    char *text = (char *)read_file(path, &len);
+    if (!text)
+        return -1;
+
+    int count = 0;
+    char buf[64];
+    const char *obj = strstr(text, "\"results\"");
+    while (obj && count < max && (obj = strstr(obj, "{\"workload\"")))
+    {
+        struct result *res = &results[count];
+        memset(res, 0, sizeof(*res));
+        json_field(obj, "workload", res->workload, sizeof(res->workload));
+        json_field(obj, "engine", res->engine, sizeof(res->engine));
+        if (json_field(obj, "instructions", buf, sizeof(buf)))
+            res->instructions = strtoull(buf, NULL, 10);
+        if (json_field(obj, "runs", buf, sizeof(buf)))
+            res->runs = atoi(buf);
+
+        // The statistics are taken again from the samples
+        const char *p = json_field(obj, "samples", buf, sizeof(buf));
+        if (p && *p == '[' && res->runs > 0)
+        {
+            res->ns = malloc(res->runs * sizeof(*res->ns));
+            p++;
+            for (int i = 0; i < res->runs; i++)
+                res->ns[i] = strtod(p + strspn(p, ", "), (char **)&p);
+            summarize(res);
+            count++;
+        }
+        obj++;
+    }
+    free(text);
+    return count;
+}
+
+// Two sided 95% quantile of Student's t distribution with df degrees of freedom
+double t95(double df)
+{
+    static const double table[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                   2.201,  2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                                   2.080,  2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+    if (df < 1)
+        return table[0];
+    if (df <= 30)
+        return table[(int)df - 1];
+    return 1.960 + 2.46 / df;
+}
+
+// Compare every result with the baseline result of the same workload and engine.
+// The difference of the mean ns per instruction gets a 95% confidence interval from
+// Welch's t test, which does not assume both runs are equally noisy. A workload
+// regressed when the whole interval lies above threshold percent of the baseline:
+// separate processes differ by a percent or two in code and data placement alone,
+// which no number of repetitions in one process averages out. Returns the number of
+// regressions
+int compare_results(const struct result *results, int count, const struct result *base, int base_count,
+                    double threshold)
+{
+    int regressions = 0;
+    printf("\n%-12s %-8s %12s %12s %20s\n", "workload", "engine", "base ns", "ns", "change");
+    for (int i = 0; i < count; i++)
+    {
+        const struct result *now = &results[i];
+        const struct result *old = NULL;
+        for (int j = 0; j < base_count; j++)
+        {
+            if (strcmp(base[j].workload, now->workload) == 0 && strcmp(base[j].engine, now->engine) == 0)
+                old = &base[j];
+        }
+        if (!old)
+        {
+            printf("%-12s %-8s not in baseline\n", now->workload, now->engine);
+            continue;
+        }
+
+        double v1 = now->stddev * now->stddev / now->runs;
+        double v2 = old->stddev * old->stddev / old->runs;
+        double se = sqrt(v1 + v2);
+        double df = 1;
+        if (v1 + v2 > 0)
+            df = (v1 + v2) * (v1 + v2) /
+                 ((now->runs > 1 ? v1 * v1 / (now->runs - 1) : 0) + (old->runs > 1 ? v2 * v2 / (old->runs - 1) : 0) +
+                  1e-300);
+        double diff = now->mean - old->mean;
+        double ci = t95(df) * se;
+
+        const char *verdict = "";
+        if (diff - ci > old->mean * threshold / 100)
+        {
+            verdict = "  REGRESSION";
+            regressions++;
+        }
+        else if (diff + ci < -old->mean * threshold / 100)
+        {
+            verdict = "  faster";
+        }
+        if (now->instructions != old->instructions)
+            verdict = "  instruction count changed";
+
+        printf("%-12s %-8s %12.4f %12.4f %+9.2f%% +-%6.2f%%%s\n", now->workload, now->engine, old->mean, now->mean,
+               100 * diff / old->mean, 100 * ci / old->mean, verdict);
+    }
+    return regressions;
+}
+
+int main(int argc, const char *argv[])
+{
+    int reps = BENCH_REPS;
+    const char *dir = "bench";
+    const char *json_path = NULL;
+    const char *baseline_path = NULL;
+    double threshold = BENCH_THRESHOLD;
+    const char *only[WORKLOAD_COUNT];
+    int only_count = 0;
+
+    for (int j = 1; j < argc; j++)
+    {
+        if (strcmp(argv[j], "-n") == 0 && j + 1 < argc)
+        {
+            reps = atoi(argv[++j]);
+        }
+        else if (strcmp(argv[j], "-d") == 0 && j + 1 < argc)
+        {
+            dir = argv[++j];
+        }
+        else if (strcmp(argv[j], "-j") == 0 && j + 1 < argc)
+        {
+            json_path = argv[++j];
+        }
+        else if (strcmp(argv[j], "-c") == 0 && j + 1 < argc)
+        {
+            baseline_path = argv[++j];
+        }
+        else if (strcmp(argv[j], "-t") == 0 && j + 1 < argc)
+        {
+            threshold = atof(argv[++j]);
+        }
+        else if (argv[j][0] != '-' && only_count < WORKLOAD_COUNT)
+        {
+            only[only_count++] = argv[j];
+        }
+        else
+        {
+            printf("bench [-n reps] [-d dir] [-j out.json] [-c baseline.json] [-t percent] [workload ..]\n");
+            exit(2);
+        }
+    }
+    if (reps < 1)
+        reps = 1;
+
+    // Read the baseline first, a typo should not cost a whole benchmark run
+    static struct result base[MAX_RESULTS];
+    int base_count = 0;
+    if (baseline_path)
+    {
+        base_count = read_json(baseline_path, base, MAX_RESULTS);
+        if (base_count < 0)
+        {
+            printf("failed to read baseline: %s\n", baseline_path);
+            exit(2);
+        }
+    }
+
+    printf("%-12s %-8s %14s %10s %10s %9s %10s\n", "workload", "engine", "instructions", "mean ms", "min ms", "stddev",
+           "MIPS");
+    static struct result results[MAX_RESULTS];
+    int count = 0;
+    int failed = 0;
+    double log_mips[ENGINE_COUNT] = {0};
+    int passed[ENGINE_COUNT] = {0};
+    for (int i = 0; i < WORKLOAD_COUNT; i++)
+    {
+        int selected = only_count == 0;
+        for (int k = 0; k < only_count; k++)
+            selected |= strcmp(only[k], workloads[i].name) == 0;
+        if (!selected)
+            continue;
+
+        for (int e = 0; e < ENGINE_COUNT && count < MAX_RESULTS; e++)
+        {
+            if (bench_workload(dir, &workloads[i], &engines[e], reps, &results[count]))
+            {
+                log_mips[e] += log(1e3 / results[count].mean);
+                passed[e]++;
+                count++;
+            }
+            else
+            {
+                failed = 1;
+            }
+        }
+    }
+
+    // The geometric mean weighs every workload the same, however long it runs
+    for (int e = 0; e < ENGINE_COUNT; e++)
+    {
+        if (passed[e] > 1)
+            printf("%-12s %-8s %58.2f\n", "geomean", engines[e].name, exp(log_mips[e] / passed[e]));
+    }
+
+    if (json_path && !write_json(json_path, results, count, reps))
+    {
+        printf("failed to write results: %s\n", json_path);
+        failed = 1;
+    }
+    if (baseline_path && compare_results(results, count, base, base_count, threshold) > 0)
+        failed = 1;
+    return failed;
+}
@@ -0,0 +1,137 @@
+; Bubble sort of 400 pseudo random numbers. Prints whether the result is sorted and
+; its first and last element
+.ORIG x3000
+        JSR GEN
+        LD R5, N
+        ADD R5, R5, #-1         ; Compares in the next pass
+OUTER   LD R1, ARRAY
+        ADD R4, R5, #0
+INNER   LDR R2, R1, #0
+        LDR R3, R1, #1
+        NOT R0, R3
+        ADD R0, R0, #1
+        ADD R0, R2, R0
+        BRnz NOSWAP
+        STR R3, R1, #0
+        STR R2, R1, #1
+NOSWAP  ADD R1, R1, #1
+        ADD R4, R4, #-1
+        BRp INNER
+        ADD R5, R5, #-1
+        BRp OUTER
+        JSR REPORT
+        HALT
+N       .FILL #400
+
+; Fill N words at ARRAY from the generator x = 5x + 1 mod 2^15
+GEN     LD R1, ARRAY
+        LD R2, N
+        LD R0, SEED
+        LD R4, TOPBIT
+GEN_LP  ADD R3, R0, R0
+        ADD R3, R3, R3
+        ADD R0, R3, R0
+        ADD R0, R0, #1
+        BRzp GEN_POS
+        ADD R0, R0, R4          ; Drop bit 15
+GEN_POS STR R0, R1, #0
+        ADD R1, R1, #1
+        ADD R2, R2, #-1
+        BRp GEN_LP
+        RET
+
+; Print "sorted" or "UNSORTED", then the first and last element
+REPORT  ST R7, RP_R7
+        LD R1, ARRAY
+        LD R2, N
+        ADD R2, R2, #-1
+RP_LP   LDR R3, R1, #0
+        LDR R4, R1, #1
+        NOT R4, R4
+        ADD R4, R4, #1
+        ADD R4, R3, R4
+        BRp RP_BAD
+        ADD R1, R1, #1
+        ADD R2, R2, #-1
+        BRp RP_LP
+        LEA R0, RP_OK
+        BR RP_OUT
+RP_BAD  LEA R0, RP_NOK
+RP_OUT  PUTS
+        LD R1, ARRAY
+        LDR R0, R1, #0
+        JSR PRINTNUM
+        LD R0, RP_SP
+        OUT
+        LD R2, N
+        ADD R1, R1, R2
+        LDR R0, R1, #-1
+        JSR PRINTNUM
+        LD R0, RP_NL
+        OUT
+        LD R7, RP_R7
+        RET
+RP_OK   .STRINGZ "sorted "
+RP_NOK  .STRINGZ "UNSORTED "
+RP_SP   .FILL x20
+RP_NL   .FILL x0A
+RP_R7   .BLKW 1
+TOPBIT  .FILL x8000
+SEED    .FILL #12345
+ARRAY   .FILL x4000
+; Print R0 (0 to 32767) in decimal. Preserves all registers but R7
+PRINTNUM ST R0, PN_R0
+        ST R1, PN_R1
+        ST R2, PN_R2
+        ST R3, PN_R3
+        ST R4, PN_R4
+        ST R5, PN_R5
+        ST R7, PN_R7
+        ADD R1, R0, #0          ; Value left to print
+        LEA R2, PN_POW          ; Next negated power of ten
+        AND R4, R4, #0          ; Sum of the digits printed so far
+PN_NEXT LDR R3, R2, #0
+        BRz PN_END
+        AND R0, R0, #0          ; Digit
+PN_SUB  ADD R1, R1, R3
+        BRn PN_BACK
+        ADD R0, R0, #1
+        BR PN_SUB
+PN_BACK NOT R3, R3
+        ADD R3, R3, #1
+        ADD R1, R1, R3          ; Undo the last subtraction
+        ADD R5, R4, R0
+        BRz PN_SKIP             ; Leading zero
+        ADD R4, R5, #0
+        LD R5, PN_ZERO
+        ADD R0, R0, R5
+        OUT
+PN_SKIP ADD R2, R2, #1
+        BR PN_NEXT
+PN_END  ADD R4, R4, #0
+        BRnp PN_RET
+        LD R0, PN_ZERO
+        OUT
+PN_RET  LD R0, PN_R0
+        LD R1, PN_R1
+        LD R2, PN_R2
+        LD R3, PN_R3
+        LD R4, PN_R4
+        LD R5, PN_R5
+        LD R7, PN_R7
+        RET
+PN_POW  .FILL #-10000
+        .FILL #-1000
+        .FILL #-100
+        .FILL #-10
+        .FILL #-1
+        .FILL #0
+PN_ZERO .FILL x30
+PN_R0   .BLKW 1
+PN_R1   .BLKW 1
+PN_R2   .BLKW 1
+PN_R3   .BLKW 1
+PN_R4   .BLKW 1
+PN_R5   .BLKW 1
+PN_R7   .BLKW 1
+.END
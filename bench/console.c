@@ -0,0 +1,429 @@
+// Console I/O throughput of the trap handlers, run by `make console`
+//
+//   console [-n reps] [-b lc3-binary]
+//
+// Runs guests that do little but console I/O in lc3 processes (default build/lc3)
+// with stdout or stdin on /dev/null, a pipe or a file:
+//
+//   out    OUT of one character at a time, 1M characters
+//   puts   PUTS of a 1023 character string, 1M characters
+//   putsp  PUTSP of a 1022 character packed string, 1M characters
+//   getc   GETC until end of input, 1M characters of input
+//
+// each once as is and once with --async-io. Reported are bytes per second and read
+// and write system calls per KB, both net of a guest that only HALTs on the same
+// stdin and stdout, so process startup and image loading drop out. The system calls
+// are syscr + syscw of /proc/PID/io, read after the VM exits and before it is reaped.
+// io_uring_enter does not count there, so the async rows say n/a when lc3 can use
+// io_uring. On the thread pool backend they count the workers' reads and writes.
+#include <spawn.h>
+#include <sys/wait.h>
+
+#define LC3_NO_MAIN
+#include "../src/vm.c"
+#include "encode.h"
+
+extern char **environ;
+
+enum
+{
+    CONSOLE_REPS = 5,
+    IO_BYTES = 1 << 20,
+    STRING_ADDR = 0x4000,
+    PIPE_CHUNK = 1 << 16,
+};
+
+// Where the side of the console a guest uses is connected
+enum
+{
+    TARGET_DEVNULL,
+    TARGET_PIPE,
+    TARGET_FILE,
+};
+
+const char *target_names[] = {"/dev/null", "pipe", "file"};
+
+// A generated guest: program at x3000, image is the .obj contents
+struct guest
+{
+    const char *name;
+    int input; // Reads the console instead of writing it
+    uint64_t bytes;
+    uint16_t image[0x2000];
+    int words;
+};
+
+struct guest guests[] = {
+    {.name = "out"},
+    {.name = "puts"},
+    {.name = "putsp"},
+    {.name = "getc", .input = 1},
+};
+
+enum
+{
+    GUEST_COUNT = sizeof(guests) / sizeof(guests[0])
+};
+
+// Resources usage of one lc3 process
+struct usage
+{
+    double seconds;
+    uint64_t syscalls;
+    uint64_t bytes; // Output seen by the parent, or input taken by the guest
+    int status;
+};
+
+char tmp_dir[] = "/tmp/lc3-console-XXXXXX";
+char input_path[600];
+
+// Put word at address addr of guest g
+void emit(struct guest *g, uint16_t addr, uint16_t word)
+{
+    int i = addr - 0x3000 + 1;
+    g->image[i] = word;
+    if (i + 1 > g->words)
+        g->words = i + 1;
+}
+
+// 1024 passes over a loop of OUT x32 with R6 counting down, R0 = 'x'
+void build_out(struct guest *g)
+{
+    enum
+    {
+        UNROLL = 32,
+        ITERATIONS = IO_BYTES / UNROLL,
+    };
+    uint16_t count = 0x3003 + UNROLL + 5, chr = count + 1, pass = chr + 1;
+
+    // The counter is positive up to 32767, so the 32768 iterations are two passes
+    emit(g, 0x3000, enc_pc9(OP_LD, R_R5, pass - 0x3000));
+    emit(g, 0x3001, enc_pc9(OP_LD, R_R0, chr - 0x3001));
+    emit(g, 0x3002, enc_pc9(OP_LD, R_R6, count - 0x3002));
+    for (int i = 0; i < UNROLL; i++)
+        emit(g, 0x3003 + i, enc_trap(TRAP_OUT));
+    uint16_t pc = 0x3003 + UNROLL;
+    emit(g, pc, enc_add_imm(R_R6, R_R6, -1));
+    emit(g, pc + 1, enc_br(BR_P, 0x3003 - (pc + 1)));
+    emit(g, pc + 2, enc_add_imm(R_R5, R_R5, -1));
+    emit(g, pc + 3, enc_br(BR_P, 0x3002 - (pc + 3)));
+    emit(g, pc + 4, enc_trap(TRAP_HALT));
+    emit(g, count, ITERATIONS / 2);
+    emit(g, chr, 'x');
+    emit(g, pass, 2);
+    g->bytes = IO_BYTES;
+}
+
+// PUTS of a 1023 character string, 1024 times. packed puts two characters per word
+// for PUTSP, 1022 per call
+void build_puts(struct guest *g, int packed)
+{
+    uint16_t count = 0x3007, strp = 0x3008;
+    int chars = packed ? 1022 : 1023;
+
+    emit(g, 0x3000, enc_pc9(OP_LD, R_R6, count - 0x3000));
+    emit(g, 0x3001, enc_pc9(OP_LD, R_R0, strp - 0x3001));
+    emit(g, 0x3002, enc_trap(packed ? TRAP_PUTSP : TRAP_PUTS));
+    emit(g, 0x3003, enc_add_imm(R_R6, R_R6, -1));
+    emit(g, 0x3004, enc_br(BR_P, 0x3001 - 0x3004));
+    emit(g, 0x3005, enc_trap(TRAP_HALT));
+    emit(g, count, IO_BYTES / 1024);
+    emit(g, strp, STRING_ADDR);
+
+    // Lines of 63 letters
+    uint16_t addr = STRING_ADDR;
+    for (int i = 0; i < chars; i += packed ? 2 : 1)
+    {
+        uint16_t c1 = i % 64 == 63 ? '\n' : 'a' + i % 26;
+        uint16_t c2 = (i + 1) % 64 == 63 ? '\n' : 'a' + (i + 1) % 26;
+        emit(g, addr++, packed ? c1 | c2 << 8 : c1);
+    }
+    emit(g, addr, 0);
+    g->bytes = (uint64_t)chars * (IO_BYTES / 1024);
+}
+
+// GETC until R0 = xFFFF, end of input
+void build_getc(struct guest *g)
+{
+    emit(g, 0x3000, enc_trap(TRAP_GETC));
+    emit(g, 0x3001, enc_add_imm(R_R1, R_R0, 1));
+    emit(g, 0x3002, enc_br(BR_N | BR_P, 0x3000 - 0x3002));
+    emit(g, 0x3003, enc_trap(TRAP_HALT));
+    g->bytes = IO_BYTES;
+}
+
+int write_guest(const struct guest *g, const char *path)
+{
+    uint8_t *buf = malloc(2 * g->words);
+    uint16_t origin = 0x3000;
+    for (int i = 0; i < g->words; i++)
+    {
+        uint16_t w = i ? g->image[i] : origin;
+        buf[2 * i] = w >> 8;
+        buf[2 * i + 1] = w & 0xFF;
+    }
+
+    FILE *file = fopen(path, "wb");
+    int ok = file && fwrite(buf, 2, g->words, file) == (size_t)g->words;
+    if (file && fclose(file) != 0)
+        ok = 0;
+    free(buf);
+    return ok;
+}
+
+double timespec_diff(struct timespec a, struct timespec b)
+{
+    return (b.tv_sec - a.tv_sec) + (b.tv_nsec - a.tv_nsec) / 1e9;
+}
+
+// syscr + syscw of an exited, not yet reaped process
+uint64_t process_syscalls(pid_t pid)
+{
+    char path[64], line[128];
+    snprintf(path, sizeof(path), "/proc/%d/io", (int)pid);
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return 0;
+
+    uint64_t n = 0;
+    while (fgets(line, sizeof(line), file))
+    {
+        unsigned long long v;
+        if (sscanf(line, "syscr: %llu", &v) == 1 || sscanf(line, "syscw: %llu", &v) == 1)
+            n += v;
+    }
+    fclose(file);
+    return n;
+}
+
+// Run lc3 on image with the guest's side of the console on target. The other side
+// is /dev/null
+int run_vm(const char *lc3, const char *image, int input, int target, int async, struct usage *u)
+{
+    const char *argv[] = {lc3, async ? "--async-io" : image, async ? image : NULL, NULL};
+    char output_path[600];
+    snprintf(output_path, sizeof(output_path), "%s/output", tmp_dir);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    int fds[2] = {-1, -1};
+    int fd = input ? STDIN_FILENO : STDOUT_FILENO;
+    if (target == TARGET_PIPE)
+    {
+        if (pipe(fds) < 0)
+            return 0;
+        posix_spawn_file_actions_adddup2(&actions, input ? fds[0] : fds[1], fd);
+        posix_spawn_file_actions_addclose(&actions, fds[0]);
+        posix_spawn_file_actions_addclose(&actions, fds[1]);
+    }
+    else if (target == TARGET_FILE)
+    {
+        posix_spawn_file_actions_addopen(&actions, fd, input ? input_path : output_path,
+                                         input ? O_RDONLY : O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    else
+    {
+        posix_spawn_file_actions_addopen(&actions, fd, "/dev/null", input ? O_RDONLY : O_WRONLY, 0);
+    }
+    posix_spawn_file_actions_addopen(&actions, input ? STDOUT_FILENO : STDIN_FILENO, "/dev/null",
+                                     input ? O_WRONLY : O_RDONLY, 0);
+
+    // This process ignores SIGPIPE, the VM gets it back
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t sigpipe;
+    sigemptyset(&sigpipe);
+    sigaddset(&sigpipe, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &sigpipe);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid;
+    int err = posix_spawn(&pid, lc3, &actions, &attr, (char *const *)argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (err)
+        return 0;
+
+    // Feed or drain the pipe, the VM is the other end
+    u->bytes = 0;
+    if (target == TARGET_PIPE)
+    {
+        static uint8_t buf[PIPE_CHUNK];
+        if (input)
+        {
+            close(fds[0]);
+            memset(buf, 'x', sizeof(buf));
+            for (int sent = 0; sent < IO_BYTES; sent += PIPE_CHUNK)
+            {
+                if (write(fds[1], buf, PIPE_CHUNK) != PIPE_CHUNK)
+                    break;
+            }
+            close(fds[1]);
+        }
+        else
+        {
+            close(fds[1]);
+            ssize_t n;
+            while ((n = read(fds[0], buf, sizeof(buf))) > 0)
+                u->bytes += n;
+            close(fds[0]);
+        }
+    }
+
+    siginfo_t info;
+    waitid(P_PID, pid, &info, WEXITED | WNOWAIT);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    u->seconds = timespec_diff(start, end);
+    u->syscalls = process_syscalls(pid);
+    int status;
+    waitpid(pid, &status, 0);
+    u->status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+
+    if (!input && target == TARGET_FILE)
+    {
+        struct stat st;
+        if (stat(output_path, &st) == 0)
+            u->bytes = st.st_size;
+    }
+    return 1;
+}
+
+int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Median time of reps runs, after a warm-up. Syscalls and bytes are those of the last
+int median_run(const char *lc3, const char *image, int input, int target, int async, int reps, struct usage *u)
+{
+    double *seconds = malloc(reps * sizeof(*seconds));
+    int ok = run_vm(lc3, image, input, target, async, u);
+    for (int r = 0; ok && r < reps; r++)
+    {
+        ok = run_vm(lc3, image, input, target, async, u) && u->status == 0;
+        seconds[r] = u->seconds;
+    }
+    if (ok)
+    {
+        qsort(seconds, reps, sizeof(*seconds), compare_doubles);
+        u->seconds = seconds[reps / 2];
+    }
+    free(seconds);
+    return ok;
+}
+
+int write_input(void)
+{
+    snprintf(input_path, sizeof(input_path), "%s/input", tmp_dir);
+    FILE *file = fopen(input_path, "wb");
+    if (!file)
+        return 0;
+    for (int i = 0; i < IO_BYTES; i++)
+        fputc('a' + i % 26, file);
+    return fclose(file) == 0;
+}
+
+int main(int argc, const char *argv[])
+{
+    int reps = CONSOLE_REPS;
+    const char *lc3 = "build/lc3";
+
+    for (int j = 1; j < argc; j++)
+    {
+        if (strcmp(argv[j], "-n") == 0 && j + 1 < argc)
+        {
+            reps = atoi(argv[++j]);
+        }
+        else if (strcmp(argv[j], "-b") == 0 && j + 1 < argc)
+        {
+            lc3 = argv[++j];
+        }
+        else
+        {
+            printf("console [-n reps] [-b lc3-binary]\n");
+            exit(2);
+        }
+    }
+    if (reps < 1)
+        reps = 1;
+
+    // A guest may exit before it read all its input from the pipe
+    signal(SIGPIPE, SIG_IGN);
+
+    if (!mkdtemp(tmp_dir) || !write_input())
+    {
+        printf("failed to set up %s\n", tmp_dir);
+        exit(2);
+    }
+
+    build_out(&guests[0]);
+    build_puts(&guests[1], 0);
+    build_puts(&guests[2], 1);
+    build_getc(&guests[3]);
+
+    char halt_path[600];
+    snprintf(halt_path, sizeof(halt_path), "%s/halt.obj", tmp_dir);
+    struct guest halt = {.name = "halt"};
+    emit(&halt, 0x3000, enc_trap(TRAP_HALT));
+    write_guest(&halt, halt_path);
+
+    // lc3 picks io_uring the same way when it is there
+    int uring = uring_init();
+    if (uring)
+        uring_exit();
+
+    printf("%-6s %-10s %-6s %10s %10s %12s\n", "guest", "console", "mode", "bytes", "MB/s", "syscalls/KB");
+    int failed = 0;
+    for (int i = 0; i < GUEST_COUNT; i++)
+    {
+        struct guest *g = &guests[i];
+        char image[600];
+        snprintf(image, sizeof(image), "%s/%s.obj", tmp_dir, g->name);
+        write_guest(g, image);
+
+        // Input comes from a pipe or a file, /dev/null has none
+        for (int target = g->input ? TARGET_PIPE : TARGET_DEVNULL; target <= TARGET_FILE; target++)
+        {
+            for (int async = 0; async < 2; async++)
+            {
+                struct usage base, u;
+                if (!median_run(lc3, halt_path, g->input, target, async, reps, &base) ||
+                    !median_run(lc3, image, g->input, target, async, reps, &u))
+                {
+                    printf("%-6s %-10s %-6s failed\n", g->name, target_names[target], async ? "async" : "sync");
+                    failed = 1;
+                    continue;
+                }
+
+                double seconds = u.seconds - base.seconds;
+                double syscalls = (double)u.syscalls - (double)base.syscalls;
+                printf("%-6s %-10s %-6s %10llu %10.1f ", g->name, target_names[target], async ? "async" : "sync",
+                       (unsigned long long)g->bytes, g->bytes / seconds / 1e6);
+                if (async && uring)
+                    printf("%12s\n", "n/a");
+                else
+                    printf("%12.3f\n", syscalls / (g->bytes / 1024.0));
+
+                // The bytes that reached a pipe or file, "HALT\n" included
+                if (!g->input && target != TARGET_DEVNULL && u.bytes != g->bytes + 5)
+                {
+                    printf("%-6s %-10s %-6s wrote %llu bytes\n", g->name, target_names[target],
+                           async ? "async" : "sync", (unsigned long long)u.bytes);
+                    failed = 1;
+                }
+            }
+        }
+        unlink(image);
+    }
+
+    unlink(halt_path);
+    unlink(input_path);
+    char output_path[600];
+    snprintf(output_path, sizeof(output_path), "%s/output", tmp_dir);
+    unlink(output_path);
+    rmdir(tmp_dir);
+    return failed;
+}
@@ -0,0 +1,60 @@
+// Instruction encoders for the benchmarks that generate their guest programs. off is
+// the word distance from the instruction to its target, the PC + 1 bias is taken care
+// of here. Include after src/vm.c
+#ifndef ENCODE_H
+#define ENCODE_H
+
+static inline uint16_t enc_add_imm(int dr, int sr, int imm)
+{
+    return (OP_ADD << 12) | (dr << 9) | (sr << 6) | 0x20 | (imm & 0x1F);
+}
+
+static inline uint16_t enc_add_reg(int dr, int sr1, int sr2)
+{
+    return (OP_ADD << 12) | (dr << 9) | (sr1 << 6) | sr2;
+}
+
+static inline uint16_t enc_and_imm(int dr, int sr, int imm)
+{
+    return (OP_AND << 12) | (dr << 9) | (sr << 6) | 0x20 | (imm & 0x1F);
+}
+
+static inline uint16_t enc_not(int dr, int sr)
+{
+    return (OP_NOT << 12) | (dr << 9) | (sr << 6) | 0x3F;
+}
+
+static inline uint16_t enc_br(int nzp, int off)
+{
+    return (OP_BR << 12) | (nzp << 9) | ((off - 1) & 0x1FF);
+}
+
+static inline uint16_t enc_pc9(int op, int r, int off)
+{
+    return (op << 12) | (r << 9) | ((off - 1) & 0x1FF);
+}
+
+static inline uint16_t enc_base6(int op, int r, int base, int off)
+{
+    return (op << 12) | (r << 9) | (base << 6) | (off & 0x3F);
+}
+
+static inline uint16_t enc_jsr(int off)
+{
+    return (OP_JSR << 12) | 0x800 | ((off - 1) & 0x7FF);
+}
+
+static inline uint16_t enc_trap(int vector)
+{
+    return (OP_TRAP << 12) | vector;
+}
+
+enum
+{
+    BR_N = 4,
+    BR_Z = 2,
+    BR_P = 1,
+    RET = (OP_JMP << 12) | (R_R7 << 6),
+};
+
+#endif
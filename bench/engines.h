@@ -0,0 +1,21 @@
+// The dispatch strategies built into the benchmark programs. vm_run's switch is the
+// only one so far, others are added here as they are written. Include after src/vm.c
+#ifndef ENGINES_H
+#define ENGINES_H
+
+struct engine
+{
+    const char *name;
+    int (*run)(void);
+};
+
+static const struct engine engines[] = {
+    {"switch", vm_run},
+};
+
+enum
+{
+    ENGINE_COUNT = sizeof(engines) / sizeof(engines[0])
+};
+
+#endif
@@ -0,0 +1,89 @@
+; Recursive Fibonacci: prints fib(23) = 28657
+.ORIG x3000
+        LD R6, STACK
+        LD R0, N
+        JSR FIB
+        JSR PRINTNUM
+        LEA R0, NL
+        PUTS
+        HALT
+N       .FILL #23
+STACK   .FILL xF000
+NL      .STRINGZ "\n"
+
+; R0 = fib(R0), R6 is the stack pointer
+FIB     ADD R6, R6, #-3
+        STR R7, R6, #0
+        STR R1, R6, #1
+        STR R2, R6, #2
+        ADD R1, R0, #-2
+        BRn FIB_END             ; fib(0) = 0, fib(1) = 1
+        ADD R1, R0, #0
+        ADD R0, R1, #-1
+        JSR FIB
+        ADD R2, R0, #0
+        ADD R0, R1, #-2
+        JSR FIB
+        ADD R0, R0, R2
+FIB_END LDR R7, R6, #0
+        LDR R1, R6, #1
+        LDR R2, R6, #2
+        ADD R6, R6, #3
+        RET
+
+; Print R0 (0 to 32767) in decimal. Preserves all registers but R7
+PRINTNUM ST R0, PN_R0
+        ST R1, PN_R1
+        ST R2, PN_R2
+        ST R3, PN_R3
+        ST R4, PN_R4
+        ST R5, PN_R5
+        ST R7, PN_R7
+        ADD R1, R0, #0          ; Value left to print
+        LEA R2, PN_POW          ; Next negated power of ten
+        AND R4, R4, #0          ; Sum of the digits printed so far
+PN_NEXT LDR R3, R2, #0
+        BRz PN_END
+        AND R0, R0, #0          ; Digit
+PN_SUB  ADD R1, R1, R3
+        BRn PN_BACK
+        ADD R0, R0, #1
+        BR PN_SUB
+PN_BACK NOT R3, R3
+        ADD R3, R3, #1
+        ADD R1, R1, R3          ; Undo the last subtraction
+        ADD R5, R4, R0
+        BRz PN_SKIP             ; Leading zero
+        ADD R4, R5, #0
+        LD R5, PN_ZERO
+        ADD R0, R0, R5
+        OUT
+PN_SKIP ADD R2, R2, #1
+        BR PN_NEXT
+PN_END  ADD R4, R4, #0
+        BRnp PN_RET
+        LD R0, PN_ZERO
+        OUT
+PN_RET  LD R0, PN_R0
+        LD R1, PN_R1
+        LD R2, PN_R2
+        LD R3, PN_R3
+        LD R4, PN_R4
+        LD R5, PN_R5
+        LD R7, PN_R7
+        RET
+PN_POW  .FILL #-10000
+        .FILL #-1000
+        .FILL #-100
+        .FILL #-10
+        .FILL #-1
+        .FILL #0
+PN_ZERO .FILL x30
+PN_R0   .BLKW 1
+PN_R1   .BLKW 1
+PN_R2   .BLKW 1
+PN_R3   .BLKW 1
+PN_R4   .BLKW 1
+PN_R5   .BLKW 1
+PN_R7   .BLKW 1
+.END
@@ -0,0 +1,262 @@
+// Per-opcode microbenchmarks, run by `make micro`
+//
+//   micro [-n reps] [kernel ..]
+//
+// Every kernel is a loop whose body repeats one class of instruction, so its time per
+// instruction is the cost of that OP_* case in vm_run. The loop is generated in guest
+// memory here and counts down R6:
+//
+//   x3000  LD R6, COUNT
+//          LEA R5, DATA
+//   LOOP   body, BODY_LENGTH instructions
+//          ADD R6, R6, #-1
+//          BRp LOOP
+//          HALT
+//   COUNT  .FILL iterations
+//   DATA   .BLKW 4
+//   PTR    .FILL DATA + 2
+//   SUB    RET
+//
+// The two loop instructions are 3% of the stream. Output goes to memory, so the
+// TRAP kernel times the handler and not a terminal.
+#include <math.h>
+
+#define LC3_NO_MAIN
+#include "../src/vm.c"
+#include "encode.h"
+#include "engines.h"
+
+enum
+{
+    MICRO_REPS = 10,
+    BODY_LENGTH = 64,
+    ITERATIONS = 32767, // Largest positive COUNT, 2.2 million instructions per run
+};
+
+// Addresses of the generated program
+enum
+{
+    LOOP_START = 0x3002,
+    COUNT_ADDR = LOOP_START + BODY_LENGTH + 3,
+    DATA_ADDR = COUNT_ADDR + 1,
+    PTR_ADDR = DATA_ADDR + 4,
+    SUB_ADDR = PTR_ADDR + 1,
+};
+
+// Kernel bodies: the instruction at pc, the i-th of the body. R6 is the loop
+// counter and R5 points at DATA, neither may be written
+
+// ADD, AND and NOT with immediates and registers, every one setting the flags
+uint16_t body_alu(int i, uint16_t pc)
+{
+    (void)pc;
+    switch (i % 4)
+    {
+    case 0:
+        return enc_add_imm(R_R0, R_R0, 1);
+    case 1:
+        return enc_and_imm(R_R1, R_R0, 7);
+    case 2:
+        return enc_not(R_R2, R_R1);
+    default:
+        return enc_add_reg(R_R3, R_R3, R_R2);
+    }
+}
+
+// BRnzp to the next instruction
+uint16_t body_br_taken(int i, uint16_t pc)
+{
+    (void)i;
+    (void)pc;
+    return enc_br(BR_N | BR_Z | BR_P, 1);
+}
+
+// BRnz while the flags are positive from the loop counter
+uint16_t body_br_not_taken(int i, uint16_t pc)
+{
+    (void)i;
+    (void)pc;
+    return enc_br(BR_N | BR_Z, 1);
+}
+
+// LD, LDR and LDI
+uint16_t body_load(int i, uint16_t pc)
+{
+    switch (i % 3)
+    {
+    case 0:
+        return enc_pc9(OP_LD, R_R0, DATA_ADDR - pc);
+    case 1:
+        return enc_base6(OP_LDR, R_R1, R_R5, 1);
+    default:
+        return enc_pc9(OP_LDI, R_R2, PTR_ADDR - pc);
+    }
+}
+
+// ST, STR and STI
+uint16_t body_store(int i, uint16_t pc)
+{
+    switch (i % 3)
+    {
+    case 0:
+        return enc_pc9(OP_ST, R_R0, DATA_ADDR - pc);
+    case 1:
+        return enc_base6(OP_STR, R_R0, R_R5, 1);
+    default:
+        return enc_pc9(OP_STI, R_R0, PTR_ADDR - pc);
+    }
+}
+
+// JSR to a lone RET, half of the stream is RET
+uint16_t body_call(int i, uint16_t pc)
+{
+    (void)i;
+    return enc_jsr(SUB_ADDR - pc);
+}
+
+// TRAP x21, writing whatever is in R0
+uint16_t body_out(int i, uint16_t pc)
+{
+    (void)i;
+    (void)pc;
+    return enc_trap(TRAP_OUT);
+}
+
+struct kernel
+{
+    const char *name;
+    const char *mix;
+    uint16_t (*body)(int i, uint16_t pc);
+};
+
+const struct kernel kernels[] = {
+    {"alu", "ADD imm, AND imm, NOT, ADD reg", body_alu},
+    {"br-taken", "BRnzp", body_br_taken},
+    {"br-not-taken", "BRnz on p", body_br_not_taken},
+    {"load", "LD, LDR, LDI", body_load},
+    {"store", "ST, STR, STI", body_store},
+    {"call", "JSR, RET", body_call},
+    {"trap-out", "TRAP OUT to memory", body_out},
+};
+
+enum
+{
+    KERNEL_COUNT = sizeof(kernels) / sizeof(kernels[0])
+};
+
+// Generate kernel k on a fresh machine
+void load_kernel(const struct kernel *k)
+{
+    vm_reset();
+
+    memory[0x3000] = enc_pc9(OP_LD, R_R6, COUNT_ADDR - 0x3000);
+    memory[0x3001] = enc_pc9(OP_LEA, R_R5, DATA_ADDR - 0x3001);
+    for (int i = 0; i < BODY_LENGTH; i++)
+        memory[LOOP_START + i] = k->body(i, LOOP_START + i);
+
+    uint16_t pc = LOOP_START + BODY_LENGTH;
+    memory[pc] = enc_add_imm(R_R6, R_R6, -1);
+    memory[pc + 1] = enc_br(BR_P, LOOP_START - (pc + 1));
+    memory[pc + 2] = enc_trap(TRAP_HALT);
+
+    memory[COUNT_ADDR] = ITERATIONS;
+    memory[DATA_ADDR] = '*';
+    memory[DATA_ADDR + 1] = '*';
+    memory[PTR_ADDR] = DATA_ADDR + 2;
+    memory[SUB_ADDR] = RET;
+}
+
+// Time one run, returns ns per instruction or 0 when the kernel did not halt cleanly
+double run_kernel(const struct kernel *k, const struct engine *e, uint64_t *instructions)
+{
+    load_kernel(k);
+    console_input_buffer(NULL, 0);
+    console_output_buffer();
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int status = e->run();
+    double seconds = elapsed_since(start);
+    *instructions = instret;
+    console_close();
+
+    if (status != VM_HALTED)
+        return 0;
+    return seconds * 1e9 / instret;
+}
+
+int bench_kernel(const struct kernel *k, const struct engine *e, int reps)
+{
+    uint64_t instructions;
+    double ns[reps];
+
+    // The first run warms caches and the branch predictor and is not counted
+    for (int i = -1; i < reps; i++)
+    {
+        double t = run_kernel(k, e, &instructions);
+        if (t == 0)
+        {
+            printf("%-14s %-8s did not halt\n", k->name, e->name);
+            return 0;
+        }
+        if (i >= 0)
+            ns[i] = t;
+    }
+
+    double sum = 0, min = HUGE_VAL;
+    for (int i = 0; i < reps; i++)
+    {
+        sum += ns[i];
+        if (ns[i] < min)
+            min = ns[i];
+    }
+    double mean = sum / reps;
+
+    printf("%-14s %-8s %12llu %10.3f %10.3f   %s\n", k->name, e->name, (unsigned long long)instructions, min, mean,
+           k->mix);
+    return 1;
+}
+
+int main(int argc, const char *argv[])
+{
+    int reps = MICRO_REPS;
+    const char *only[KERNEL_COUNT];
+    int only_count = 0;
+
+    for (int j = 1; j < argc; j++)
+    {
+        if (strcmp(argv[j], "-n") == 0 && j + 1 < argc)
+        {
+            reps = atoi(argv[++j]);
+        }
+        else if (argv[j][0] != '-' && only_count < KERNEL_COUNT)
+        {
+            only[only_count++] = argv[j];
+        }
+        else
+        {
+            printf("micro [-n reps] [kernel ..]\n");
+            exit(2);
+        }
+    }
+    if (reps < 1)
+        reps = 1;
+
+    printf("%-14s %-8s %12s %10s %10s   %s\n", "kernel", "engine", "instructions", "min ns", "mean ns", "mix");
+    int failed = 0;
+    for (int i = 0; i < KERNEL_COUNT; i++)
+    {
+        int selected = only_count == 0;
+        for (int k = 0; k < only_count; k++)
+            selected |= strcmp(only[k], kernels[i].name) == 0;
+        if (!selected)
+            continue;
+
+        for (int e = 0; e < ENGINE_COUNT; e++)
+        {
+            if (!bench_kernel(&kernels[i], &engines[e], reps))
+                failed = 1;
+        }
+    }
+    return failed;
+}
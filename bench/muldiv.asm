@@ -0,0 +1,160 @@
+; Software multiply and divide: for a and b from 1 to 100 divide a * b + 7 by b and sum
+; quotients and remainders modulo 2^15. Prints the sum
+.ORIG x3000
+        AND R5, R5, #0          ; Sum
+        AND R0, R0, #0
+        ADD R0, R0, #1
+        ST R0, A
+LOOP_A  AND R0, R0, #0
+        ADD R0, R0, #1
+        ST R0, B
+LOOP_B  LD R1, A
+        LD R2, B
+        JSR MUL
+        ADD R1, R0, #7
+        LD R2, B
+        JSR DIV
+        ADD R5, R5, R0
+        ADD R5, R5, R1
+        BRzp NEXT_B
+        LD R0, TOPBIT
+        ADD R5, R5, R0          ; Drop bit 15
+NEXT_B  LD R0, B
+        ADD R0, R0, #1
+        ST R0, B
+        LD R1, NEG_END
+        ADD R0, R0, R1
+        BRn LOOP_B
+        LD R0, A
+        ADD R0, R0, #1
+        ST R0, A
+        LD R1, NEG_END
+        ADD R0, R0, R1
+        BRn LOOP_A
+        ADD R0, R5, #0
+        JSR PRINTNUM
+        LEA R0, NL
+        PUTS
+        HALT
+A       .BLKW 1
+B       .BLKW 1
+NEG_END .FILL #-101
+TOPBIT  .FILL x8000
+NL      .STRINGZ "\n"
+
+; R0 = R1 * R2 modulo 2^16, shift and add over the bits of R2 from the top
+MUL     ST R3, ML_R3
+        ST R4, ML_R4
+        AND R0, R0, #0
+        ADD R3, R2, #0
+        AND R4, R4, #0
+        ADD R4, R4, #8
+        ADD R4, R4, #8
+ML_LP   ADD R0, R0, R0
+        ADD R3, R3, #0
+        BRzp ML_SKIP
+        ADD R0, R0, R1
+ML_SKIP ADD R3, R3, R3
+        ADD R4, R4, #-1
+        BRp ML_LP
+        LD R3, ML_R3
+        LD R4, ML_R4
+        RET
+ML_R3   .BLKW 1
+ML_R4   .BLKW 1
+
+; R0 = R1 / R2, R1 = R1 % R2 by restoring division. R1 below 2^15, R2 below 2^14
+DIV     ST R3, DV_R3
+        ST R4, DV_R4
+        ST R5, DV_R5
+        ST R6, DV_R6
+        ST R7, DV_R7
+        AND R0, R0, #0          ; Quotient
+        AND R3, R3, #0          ; Remainder
+        ADD R4, R1, #0          ; Dividend bits still to shift in
+        AND R5, R5, #0
+        ADD R5, R5, #8
+        ADD R5, R5, #8
+        NOT R6, R2
+        ADD R6, R6, #1          ; -divisor
+DV_LP   ADD R3, R3, R3
+        ADD R4, R4, #0
+        BRzp DV_BIT
+        ADD R3, R3, #1
+DV_BIT  ADD R4, R4, R4
+        ADD R0, R0, R0
+        ADD R7, R3, R6
+        BRn DV_NEXT
+        ADD R3, R7, #0
+        ADD R0, R0, #1
+DV_NEXT ADD R5, R5, #-1
+        BRp DV_LP
+        ADD R1, R3, #0
+        LD R3, DV_R3
+        LD R4, DV_R4
+        LD R5, DV_R5
+        LD R6, DV_R6
+        LD R7, DV_R7
+        RET
+DV_R3   .BLKW 1
+DV_R4   .BLKW 1
+DV_R5   .BLKW 1
+DV_R6   .BLKW 1
+DV_R7   .BLKW 1
+
+; Print R0 (0 to 32767) in decimal. Preserves all registers but R7
+PRINTNUM ST R0, PN_R0
+        ST R1, PN_R1
+        ST R2, PN_R2
+        ST R3, PN_R3
+        ST R4, PN_R4
+        ST R5, PN_R5
+        ST R7, PN_R7
+        ADD R1, R0, #0          ; Value left to print
+        LEA R2, PN_POW          ; Next negated power of ten
+        AND R4, R4, #0          ; Sum of the digits printed so far
+PN_NEXT LDR R3, R2, #0
+        BRz PN_END
+        AND R0, R0, #0          ; Digit
+PN_SUB  ADD R1, R1, R3
+        BRn PN_BACK
+        ADD R0, R0, #1
+        BR PN_SUB
+PN_BACK NOT R3, R3
+        ADD R3, R3, #1
+        ADD R1, R1, R3          ; Undo the last subtraction
+        ADD R5, R4, R0
+        BRz PN_SKIP             ; Leading zero
+        ADD R4, R5, #0
+        LD R5, PN_ZERO
+        ADD R0, R0, R5
+        OUT
+PN_SKIP ADD R2, R2, #1
+        BR PN_NEXT
+PN_END  ADD R4, R4, #0
+        BRnp PN_RET
+        LD R0, PN_ZERO
+        OUT
+PN_RET  LD R0, PN_R0
+        LD R1, PN_R1
+        LD R2, PN_R2
+        LD R3, PN_R3
+        LD R4, PN_R4
+        LD R5, PN_R5
+        LD R7, PN_R7
+        RET
+PN_POW  .FILL #-10000
+        .FILL #-1000
+        .FILL #-100
+        .FILL #-10
+        .FILL #-1
+        .FILL #0
+PN_ZERO .FILL x30
+PN_R0   .BLKW 1
+PN_R1   .BLKW 1
+PN_R2   .BLKW 1
+PN_R3   .BLKW 1
+PN_R4   .BLKW 1
+PN_R5   .BLKW 1
+PN_R7   .BLKW 1
+.END
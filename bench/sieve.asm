@@ -0,0 +1,107 @@
+; Sieve of Eratosthenes over 0 to 7999, ten times. Prints the number of primes, 1007
+.ORIG x3000
+        LD R5, PASSES
+PASS    LD R1, FLAGS            ; Clear the flags
+        LD R2, NEG_N
+        AND R0, R0, #0
+CLEAR   STR R0, R1, #0
+        ADD R1, R1, #1
+        ADD R2, R2, #1
+        BRn CLEAR
+
+        AND R4, R4, #0          ; Primes found
+        AND R3, R3, #0
+        ADD R3, R3, #2          ; Candidate
+NEXT    LD R0, NEG_N
+        ADD R0, R3, R0
+        BRzp DONE
+        LD R1, FLAGS
+        ADD R1, R1, R3
+        LDR R0, R1, #0
+        BRnp SKIP               ; Marked composite
+        ADD R4, R4, #1
+
+        ADD R2, R3, R3          ; Mark every multiple from 2p on
+MARK    LD R0, NEG_N
+        ADD R0, R2, R0
+        BRzp SKIP
+        LD R1, FLAGS
+        ADD R1, R1, R2
+        AND R0, R0, #0
+        ADD R0, R0, #1
+        STR R0, R1, #0
+        ADD R2, R2, R3
+        BR MARK
+
+SKIP    ADD R3, R3, #1
+        BR NEXT
+
+DONE    ADD R5, R5, #-1
+        BRp PASS
+
+        ADD R0, R4, #0
+        JSR PRINTNUM
+        LEA R0, NL
+        PUTS
+        HALT
+PASSES  .FILL #10
+NEG_N   .FILL #-8000
+FLAGS   .FILL x4000
+NL      .STRINGZ "\n"
+
+; Print R0 (0 to 32767) in decimal. Preserves all registers but R7
+PRINTNUM ST R0, PN_R0
+        ST R1, PN_R1
+        ST R2, PN_R2
+        ST R3, PN_R3
+        ST R4, PN_R4
+        ST R5, PN_R5
+        ST R7, PN_R7
+        ADD R1, R0, #0          ; Value left to print
+        LEA R2, PN_POW          ; Next negated power of ten
+        AND R4, R4, #0          ; Sum of the digits printed so far
+PN_NEXT LDR R3, R2, #0
+        BRz PN_END
+        AND R0, R0, #0          ; Digit
+PN_SUB  ADD R1, R1, R3
+        BRn PN_BACK
+        ADD R0, R0, #1
+        BR PN_SUB
+PN_BACK NOT R3, R3
+        ADD R3, R3, #1
+        ADD R1, R1, R3          ; Undo the last subtraction
+        ADD R5, R4, R0
+        BRz PN_SKIP             ; Leading zero
+        ADD R4, R5, #0
+        LD R5, PN_ZERO
+        ADD R0, R0, R5
+        OUT
+PN_SKIP ADD R2, R2, #1
+        BR PN_NEXT
+PN_END  ADD R4, R4, #0
+        BRnp PN_RET
+        LD R0, PN_ZERO
+        OUT
+PN_RET  LD R0, PN_R0
+        LD R1, PN_R1
+        LD R2, PN_R2
+        LD R3, PN_R3
+        LD R4, PN_R4
+        LD R5, PN_R5
+        LD R7, PN_R7
+        RET
+PN_POW  .FILL #-10000
+        .FILL #-1000
+        .FILL #-100
+        .FILL #-10
+        .FILL #-1
+        .FILL #0
+PN_ZERO .FILL x30
+PN_R0   .BLKW 1
+PN_R1   .BLKW 1
+PN_R2   .BLKW 1
+PN_R3   .BLKW 1
+PN_R4   .BLKW 1
+PN_R5   .BLKW 1
+PN_R7   .BLKW 1
+.END
@@ -0,0 +1,401 @@
+// Startup and image load benchmarks, run by `make startup`
+//
+//   startup [-n reps] [-b lc3-binary]
+//
+// Short guests spend much of their life before the first instruction, so this
+// measures that part on its own:
+//
+//   image load     read_image() of images from 16 words to 32K words, and of 16K
+//                  words split into up to 64 image files, each one .obj segment.
+//                  read_image_file() from memory on the same data tells the parsing
+//                  apart from opening files and looking for .sym files
+//   cold process   spawning lc3 (default build/lc3) on a guest that only HALTs,
+//                  until it exits, with one and with 64 image files
+//   first instr    spawning lc3 until the first instruction of the guest, an OUT,
+//                  shows up in a --ring-out ring. Compare it with the cold run
+//                  that writes to a ring too, setting up the ring is not free
+//
+// Times are medians over reps (default 20) after one warm-up.
+#include <sched.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+#define LC3_NO_MAIN
+#include "../src/vm.c"
+
+extern char **environ;
+
+enum
+{
+    STARTUP_REPS = 20,
+    SEGMENT_WORDS = 16384,      // Total size of the multi segment cases
+    FIRST_OUTPUT_TIMEOUT = 10,  // Seconds to wait for the first output of lc3
+    FIRST_OUTPUT_POLL = 10000,  // Microseconds between checks that lc3 still runs
+};
+
+// A set of image files, written to a temporary directory
+struct image_set
+{
+    const char *name;
+    int segments;
+    int words;             // Words per segment
+    char paths[64][512];   // One .obj per segment
+    uint8_t *data[64];     // Their contents, for read_image_file from memory
+    size_t len[64];
+};
+
+struct image_set image_sets[] = {
+    {.name = "16 words", .segments = 1, .words = 16},
+    {.name = "1K words", .segments = 1, .words = 1024},
+    {.name = "8K words", .segments = 1, .words = 8192},
+    {.name = "32K words", .segments = 1, .words = 32768},
+    {.name = "16K in 4", .segments = 4, .words = SEGMENT_WORDS / 4},
+    {.name = "16K in 16", .segments = 16, .words = SEGMENT_WORDS / 16},
+    {.name = "16K in 64", .segments = 64, .words = SEGMENT_WORDS / 64},
+};
+
+enum
+{
+    IMAGE_SET_COUNT = sizeof(image_sets) / sizeof(image_sets[0])
+};
+
+char tmp_dir[] = "/tmp/lc3-startup-XXXXXX";
+
+double timespec_diff(struct timespec a, struct timespec b)
+{
+    return (b.tv_sec - a.tv_sec) + (b.tv_nsec - a.tv_nsec) / 1e9;
+}
+
+int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+double median(double *samples, int n)
+{
+    qsort(samples, n, sizeof(*samples), compare_doubles);
+    return n % 2 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+}
+
+// Write an image of words words at origin, big endian like lc3as output. The words
+// are code: program, then HALT padding. The contents are kept in *data when it is
+// not NULL
+int write_image(const char *path, uint16_t origin, const uint16_t *program, int program_len, int words,
+                uint8_t **data, size_t *len)
+{
+    size_t size = 2 * (words + 1);
+    uint8_t *buf = malloc(size);
+    buf[0] = origin >> 8;
+    buf[1] = origin & 0xFF;
+    for (int i = 0; i < words; i++)
+    {
+        uint16_t w = i < program_len ? program[i] : (OP_TRAP << 12) | TRAP_HALT;
+        buf[2 + 2 * i] = w >> 8;
+        buf[3 + 2 * i] = w & 0xFF;
+    }
+
+    FILE *file = fopen(path, "wb");
+    int ok = file && fwrite(buf, 1, size, file) == size;
+    if (file && fclose(file) != 0)
+        ok = 0;
+
+    if (data)
+    {
+        *data = buf;
+        *len = size;
+    }
+    else
+    {
+        free(buf);
+    }
+    return ok;
+}
+
+// Segments of a set follow each other from x3000 on
+int write_image_set(struct image_set *set)
+{
+    for (int s = 0; s < set->segments; s++)
+    {
+        snprintf(set->paths[s], sizeof(set->paths[s]), "%s/set%d-%d.obj", tmp_dir, (int)(set - image_sets), s);
+        uint16_t origin = 0x3000 + s * set->words;
+        if (!write_image(set->paths[s], origin, NULL, 0, set->words, &set->data[s], &set->len[s]))
+            return 0;
+    }
+    return 1;
+}
+
+// Seconds to load every segment of set with read_image(), or read_image_file()
+// from memory when from_memory is set
+double time_load(struct image_set *set, int from_memory)
+{
+    vm_reset();
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int s = 0; s < set->segments; s++)
+    {
+        if (from_memory)
+        {
+            FILE *file = fmemopen(set->data[s], set->len[s], "rb");
+            read_image_file(file);
+            fclose(file);
+        }
+        else
+        {
+            read_image(set->paths[s]);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return timespec_diff(start, end);
+}
+
+void bench_image_loads(int reps)
+{
+    double *samples = malloc(reps * sizeof(*samples));
+    printf("%-12s %9s %9s %14s %14s %10s\n", "image load", "segments", "words", "read_image us", "from memory us",
+           "ns/word");
+    for (int i = 0; i < IMAGE_SET_COUNT; i++)
+    {
+        struct image_set *set = &image_sets[i];
+        double result[2];
+        for (int from_memory = 0; from_memory < 2; from_memory++)
+        {
+            time_load(set, from_memory);
+            for (int r = 0; r < reps; r++)
+                samples[r] = time_load(set, from_memory);
+            result[from_memory] = median(samples, reps);
+        }
+        int words = set->segments * set->words;
+        printf("%-12s %9d %9d %14.2f %14.2f %10.3f\n", set->name, set->segments, words, result[0] * 1e6,
+               result[1] * 1e6, result[0] * 1e9 / words);
+    }
+    free(samples);
+}
+
+// Start lc3 with args, stdin and stdout on /dev/null
+pid_t spawn_vm(const char *lc3, const char **args, int arg_count)
+{
+    const char *argv[80];
+    int argc = 0;
+    argv[argc++] = lc3;
+    for (int i = 0; i < arg_count && argc < 79; i++)
+        argv[argc++] = args[i];
+    argv[argc] = NULL;
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+    pid_t pid;
+    int err = posix_spawn(&pid, lc3, &actions, NULL, (char *const *)argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    return err ? -1 : pid;
+}
+
+// Seconds from spawning lc3 to its exit
+double time_cold_run(const char *lc3, const char **args, int arg_count)
+{
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid = spawn_vm(lc3, args, arg_count);
+    if (pid < 0)
+        return -1;
+
+    int status;
+    waitpid(pid, &status, 0);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? timespec_diff(start, end) : -1;
+}
+
+// Seconds from spawning lc3 to the first output of a guest that starts with OUT and
+// then spins. The ring is created by lc3 while it parses its arguments, so it is
+// polled for until it exists. -1 when lc3 exits first or nothing shows up within
+// FIRST_OUTPUT_TIMEOUT
+double time_first_instruction(const char *lc3, const char *image)
+{
+    char ring_name[64];
+    snprintf(ring_name, sizeof(ring_name), "lc3-startup-%d", (int)getpid());
+    ring_unlink(ring_name);
+
+    const char *args[] = {"--ring-out", ring_name, image};
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid = spawn_vm(lc3, args, 3);
+    if (pid < 0)
+        return -1;
+
+    struct ring *r = NULL;
+    const struct timespec poll = {.tv_nsec = FIRST_OUTPUT_POLL * 1000L};
+    int status, exited = 0, seen = 0;
+    for (;;)
+    {
+        if (!r)
+            r = ring_open(ring_name, 0);
+        if (r && __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) != 0)
+        {
+            seen = 1;
+            break;
+        }
+
+        // lc3 failed to start, or halted or crashed before the OUT
+        if (waitpid(pid, &status, WNOHANG) == pid)
+        {
+            exited = 1;
+            break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        if (timespec_diff(start, end) > FIRST_OUTPUT_TIMEOUT)
+            break;
+
+        if (r)
+            ring_wait_for(r, 0, &poll);
+        else
+            sched_yield();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (!exited)
+    {
+        kill(pid, SIGKILL);
+        waitpid(pid, &status, 0);
+    }
+    if (r)
+        ring_close(r);
+    ring_unlink(ring_name);
+
+    if (!seen)
+    {
+        if (exited)
+            printf("lc3 exited with status %d before its first output\n", WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+        else
+            printf("no output from lc3 within %d s\n", FIRST_OUTPUT_TIMEOUT);
+        return -1;
+    }
+    return timespec_diff(start, end);
+}
+
+// Median of reps calls of one of the timers above, after a warm-up. -1 on failure
+double median_of(int reps, double (*timer)(const char *, const char **, int), const char *lc3, const char **args,
+                 int arg_count)
+{
+    double *samples = malloc(reps * sizeof(*samples));
+    double result = timer(lc3, args, arg_count);
+    for (int r = 0; r < reps && result >= 0; r++)
+        result = samples[r] = timer(lc3, args, arg_count);
+    if (result >= 0)
+        result = median(samples, reps);
+    free(samples);
+    return result;
+}
+
+double first_instruction_timer(const char *lc3, const char **args, int arg_count)
+{
+    (void)arg_count;
+    return time_first_instruction(lc3, args[0]);
+}
+
+void print_process_line(const char *name, double seconds)
+{
+    if (seconds < 0)
+        printf("%-30s failed\n", name);
+    else
+        printf("%-30s %10.1f\n", name, seconds * 1e6);
+}
+
+void bench_processes(const char *lc3, int reps)
+{
+    char halt_path[512], spin_path[512];
+    snprintf(halt_path, sizeof(halt_path), "%s/halt.obj", tmp_dir);
+    snprintf(spin_path, sizeof(spin_path), "%s/spin.obj", tmp_dir);
+
+    // OUT, AND R1, R1, #0 for a condition code, then BRnzp to itself
+    const uint16_t spin[] = {(OP_TRAP << 12) | TRAP_OUT, (OP_AND << 12) | (R_R1 << 9) | (R_R1 << 6) | 0x20,
+                             (OP_BR << 12) | 0x0E00 | 0x1FF};
+    write_image(halt_path, 0x3000, NULL, 0, 1, NULL, NULL);
+    write_image(spin_path, 0x3000, spin, 3, 3, NULL, NULL);
+
+    printf("\n%-30s %10s\n", "process", "median us");
+
+    const char *halt_args[] = {halt_path};
+    print_process_line("cold run, HALT", median_of(reps, time_cold_run, lc3, halt_args, 1));
+
+    // The 64 segment set, plus a HALT at x3000 loaded last
+    const struct image_set *set = &image_sets[IMAGE_SET_COUNT - 1];
+    const char *many_args[65];
+    for (int s = 0; s < set->segments; s++)
+        many_args[s] = set->paths[s];
+    many_args[set->segments] = halt_path;
+    print_process_line("cold run, HALT, 64 images", median_of(reps, time_cold_run, lc3, many_args, set->segments + 1));
+
+    // The same with the ring the next line needs, to compare like with like
+    char ring_name[64];
+    snprintf(ring_name, sizeof(ring_name), "lc3-startup-halt-%d", (int)getpid());
+    const char *ring_args[] = {"--ring-out", ring_name, halt_path};
+    print_process_line("cold run, HALT, ring out", median_of(reps, time_cold_run, lc3, ring_args, 3));
+    ring_unlink(ring_name);
+
+    const char *spin_args[] = {spin_path};
+    print_process_line("first instruction", median_of(reps, first_instruction_timer, lc3, spin_args, 1));
+}
+
+void remove_images(void)
+{
+    char path[600];
+    for (int i = 0; i < IMAGE_SET_COUNT; i++)
+    {
+        for (int s = 0; s < image_sets[i].segments; s++)
+            unlink(image_sets[i].paths[s]);
+    }
+    snprintf(path, sizeof(path), "%s/halt.obj", tmp_dir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/spin.obj", tmp_dir);
+    unlink(path);
+    rmdir(tmp_dir);
+}
+
+int main(int argc, const char *argv[])
+{
+    int reps = STARTUP_REPS;
+    const char *lc3 = "build/lc3";
+
+    for (int j = 1; j < argc; j++)
+    {
+        if (strcmp(argv[j], "-n") == 0 && j + 1 < argc)
+        {
+            reps = atoi(argv[++j]);
+        }
+        else if (strcmp(argv[j], "-b") == 0 && j + 1 < argc)
+        {
+            lc3 = argv[++j];
+        }
+        else
+        {
+            printf("startup [-n reps] [-b lc3-binary]\n");
+            exit(2);
+        }
+    }
+    if (reps < 1)
+        reps = 1;
+
+    if (!mkdtemp(tmp_dir))
+    {
+        printf("failed to create temporary directory\n");
+        exit(2);
+    }
+    for (int i = 0; i < IMAGE_SET_COUNT; i++)
+    {
+        if (!write_image_set(&image_sets[i]))
+        {
+            printf("failed to write images to %s\n", tmp_dir);
+            exit(2);
+        }
+    }
+
+    bench_image_loads(reps);
+    bench_processes(lc3, reps);
+
+    remove_images();
+    return 0;
+}
@@ -0,0 +1,48 @@
+; Reverse every line of the input in place and print it, until end of input
+.ORIG x3000
+LINE    LD R1, BUF              ; End of the line read so far
+READ    GETC
+        ADD R0, R0, #0
+        BRn LAST                ; End of input
+        ADD R2, R0, #-10
+        BRz EOL
+        STR R0, R1, #0
+        ADD R1, R1, #1
+        BR READ
+EOL     JSR REVERSE
+        BR LINE
+LAST    LD R0, BUF
+        NOT R0, R0
+        ADD R0, R0, #1
+        ADD R0, R1, R0
+        BRz STOP                ; No unterminated last line
+        JSR REVERSE
+STOP    HALT
+BUF     .FILL x4000
+
+; Reverse the string from BUF to R1, print it and a newline
+REVERSE ST R7, RV_R7
+        AND R0, R0, #0
+        STR R0, R1, #0          ; Terminate for PUTS
+        LD R2, BUF              ; Left end
+        ADD R3, R1, #-1         ; Right end
+RV_LP   NOT R0, R3
+        ADD R0, R0, #1
+        ADD R0, R2, R0
+        BRzp RV_OUT             ; Ends met
+        LDR R4, R2, #0
+        LDR R5, R3, #0
+        STR R5, R2, #0
+        STR R4, R3, #0
+        ADD R2, R2, #1
+        ADD R3, R3, #-1
+        BR RV_LP
+RV_OUT  LD R0, BUF
+        PUTS
+        LD R0, RV_NL
+        OUT
+        LD R7, RV_R7
+        RET
+RV_NL   .FILL x0A
+RV_R7   .BLKW 1
+.END
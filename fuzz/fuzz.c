@@ -0,0 +1,373 @@
+// Differential fuzzer, run by `make fuzz`
+//
+//   fuzz [-n iterations] [-s seed] [-b budget] [-o failure]   random programs
+//   fuzz [-b budget] file ..                                   replay inputs, - is stdin
+//
+// Every input runs on each engine of bench/engines.h and on the reference LC-3 of
+// reference.h. At every block entry the engine reports through LC3_BLOCK_HOOK, the
+// reference catches up to the same instruction count and both are compared:
+// R0-R7, PC, COND, the memory the reference wrote since the last block and the
+// output so far. All of memory is compared when the engine stops. The first
+// difference is printed with the engine's recent instructions and the process
+// aborts, leaving the input in the failure file.
+//
+// An input is a big-endian input length, that many bytes of console input, then the
+// program as big-endian words loaded at x3000. Runs stop after the instruction
+// budget, so loops are fine.
+//
+// The same file builds a libFuzzer target with -DLC3_LIBFUZZER and an AFL target
+// with afl-cc, see README.md.
+#include <stdint.h>
+
+void fuzz_block(uint16_t pc);
+#define LC3_BLOCK_HOOK(pc) fuzz_block(pc)
+
+#define LC3_NO_MAIN
+#include "../src/vm.c"
+#include "../bench/encode.h"
+#include "../bench/engines.h"
+#include "reference.h"
+
+enum
+{
+    FUZZ_BUDGET = 4096,
+    FUZZ_ITERATIONS = 100000,
+    PROGRAM_LENGTH = 256, // Words in a random program
+    INPUT_LENGTH = 32,    // Bytes of console input for a random program
+};
+
+uint64_t fuzz_budget = FUZZ_BUDGET;
+const char *failure_path = "fuzz-failure.bin";
+
+// The input being run, saved when it fails
+const uint8_t *current_data;
+size_t current_size;
+const struct engine *current_engine;
+size_t output_checked;
+
+void save_failure(void)
+{
+    if (!failure_path)
+        return;
+
+    FILE *file = fopen(failure_path, "wb");
+    if (!file)
+        return;
+    fwrite(current_data, 1, current_size, file);
+    fclose(file);
+    fprintf(stderr, "input saved to %s, replay with: fuzz %s\n", failure_path, failure_path);
+}
+
+void fail(const char *what)
+{
+    fprintf(stderr, "fuzz: engine %s differs from the reference after %llu instructions: %s\n",
+            current_engine->name, (unsigned long long)instret, what);
+    history_dump("mismatch", 0);
+    save_failure();
+    abort();
+}
+
+void compare_word(const char *name, uint16_t engine, uint16_t reference)
+{
+    if (engine == reference)
+        return;
+
+    char what[64];
+    snprintf(what, sizeof(what), "%s is x%04X, expected x%04X", name, engine, reference);
+    fail(what);
+}
+
+void compare_memory(uint16_t addr)
+{
+    char name[16];
+    snprintf(name, sizeof(name), "mem[x%04X]", addr);
+    compare_word(name, memory[addr], ref.memory[addr]);
+}
+
+// Compare the architectural state, all of memory or only what the reference wrote
+void compare(int all_memory)
+{
+    static const char *names[] = {"R0", "R1", "R2", "R3", "R4", "R5", "R6", "R7"};
+    for (int r = 0; r < 8; r++)
+        compare_word(names[r], registers[R_R0 + r], ref.reg[r]);
+    compare_word("PC", registers[R_PC], ref.pc);
+    compare_word("COND", registers[R_COND], ref.cond);
+
+    if (all_memory || ref.dirty_all)
+    {
+        if (memcmp(memory, ref.memory, sizeof(ref.memory)) != 0)
+        {
+            for (uint32_t addr = 0; addr <= UINT16_MAX; addr++)
+                compare_memory(addr);
+        }
+    }
+    else
+    {
+        for (int i = 0; i < ref.dirty_count; i++)
+            compare_memory(ref.dirty[i]);
+    }
+    ref_dirty_clear();
+
+    size_t len;
+    const uint8_t *out = console_output(&len);
+    size_t common = len < ref.output_len ? len : ref.output_len;
+    for (size_t i = output_checked; i < common; i++)
+    {
+        if (out[i] != ref.output[i])
+        {
+            char what[64];
+            snprintf(what, sizeof(what), "output byte %zu is x%02X, expected x%02X", i, out[i], ref.output[i]);
+            fail(what);
+        }
+    }
+    if (len != ref.output_len)
+    {
+        char what[64];
+        snprintf(what, sizeof(what), "%zu bytes of output, expected %zu", len, ref.output_len);
+        fail(what);
+    }
+    output_checked = len;
+}
+
+// Run the reference up to the engine's instruction count
+void catch_up(void)
+{
+    while (ref.status == REF_RUNNING && ref.instret < instret)
+        ref_step();
+    if (ref.instret != instret)
+        fail("the reference stopped earlier");
+}
+
+void fuzz_block(uint16_t pc)
+{
+    (void)pc;
+    catch_up();
+    compare(0);
+}
+
+void run_engine(const struct engine *e, const uint8_t *input, size_t input_len, const uint8_t *program,
+                size_t words)
+{
+    current_engine = e;
+    output_checked = 0;
+
+    vm_reset();
+    ref_reset(input, input_len);
+    for (size_t i = 0; i < words; i++)
+    {
+        uint16_t word = (program[2 * i] << 8) | program[2 * i + 1];
+        memory[0x3000 + i] = word;
+        ref.memory[0x3000 + i] = word;
+    }
+
+    console_input_buffer(input, input_len);
+    console_output_buffer();
+    instr_budget = fuzz_budget;
+    stop_reports = 0;
+
+    int status = e->run();
+
+    catch_up();
+    compare(1);
+    int expected = ref.status == REF_RUNNING ? VM_BUDGET : ref.status;
+    if (status != expected)
+    {
+        char what[64];
+        snprintf(what, sizeof(what), "status %d, expected %d", status, expected);
+        fail(what);
+    }
+    console_close();
+}
+
+int fuzz_one(const uint8_t *data, size_t size)
+{
+    if (size < 2)
+        return 0;
+
+    current_data = data;
+    current_size = size;
+
+    size_t input_len = (data[0] << 8) | data[1];
+    if (input_len > size - 2)
+        input_len = size - 2;
+    const uint8_t *input = data + 2;
+    const uint8_t *program = input + input_len;
+    size_t words = (size - 2 - input_len) / 2;
+    if (words > UINT16_MAX + 1 - 0x3000)
+        words = UINT16_MAX + 1 - 0x3000;
+
+    for (int e = 0; e < ENGINE_COUNT; e++)
+        run_engine(&engines[e], input, input_len, program, words);
+    return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    // libFuzzer and AFL keep the crashing input themselves
+    failure_path = NULL;
+    return fuzz_one(data, size);
+}
+
+#ifndef LC3_LIBFUZZER
+uint64_t rng_state;
+
+uint32_t rng(void)
+{
+    // xorshift64*
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (rng_state * 0x2545F4914F6CDD1DULL) >> 32;
+}
+
+// Signed offset in [-range, range]
+int rng_offset(int range)
+{
+    return (int)(rng() % (2 * range + 1)) - range;
+}
+
+// Mostly valid instructions with short PC offsets, so programs stay near x3000 and
+// branch into each other, plus the odd raw word and pointer to the keyboard registers
+uint16_t random_word(void)
+{
+    int dr = rng() % 8, sr = rng() % 8;
+    switch (rng() % 20)
+    {
+    case 0:
+        return rng();
+    case 1:
+        return rng() % 2 ? MR_KBSR : MR_KBDR;
+    case 2:
+        return enc_add_imm(dr, sr, rng_offset(16));
+    case 3:
+        return enc_add_reg(dr, sr, rng() % 8);
+    case 4:
+        return enc_and_imm(dr, sr, rng_offset(16));
+    case 5:
+        return (OP_AND << 12) | (dr << 9) | (sr << 6) | (rng() % 8);
+    case 6:
+        return enc_not(dr, sr);
+    case 7:
+    case 8:
+        return enc_br(rng() % 8, rng_offset(8));
+    case 9:
+        return enc_pc9(OP_LD, dr, rng_offset(16));
+    case 10:
+        return enc_pc9(OP_LDI, dr, rng_offset(16));
+    case 11:
+        return (OP_LDR << 12) | (dr << 9) | (sr << 6) | (rng() & 0x3F);
+    case 12:
+        return enc_pc9(OP_LEA, dr, rng_offset(16));
+    case 13:
+        return enc_pc9(OP_ST, dr, rng_offset(16));
+    case 14:
+        return enc_pc9(OP_STI, dr, rng_offset(16));
+    case 15:
+        return (OP_STR << 12) | (dr << 9) | (sr << 6) | (rng() & 0x3F);
+    case 16:
+        return rng() % 2 ? enc_jsr(rng_offset(16)) : (OP_JSR << 12) | (sr << 6);
+    case 17:
+        return (OP_JMP << 12) | (sr << 6);
+    case 18:
+        return enc_trap(TRAP_GETC + rng() % 6);
+    default:
+        return rng() % 4 ? enc_trap(TRAP_OUT) : enc_trap(rng() & 0xFF);
+    }
+}
+
+size_t random_input(uint8_t *data)
+{
+    size_t input_len = rng() % (INPUT_LENGTH + 1);
+    size_t words = 1 + rng() % PROGRAM_LENGTH;
+
+    data[0] = input_len >> 8;
+    data[1] = input_len & 0xFF;
+    uint8_t *p = data + 2;
+    for (size_t i = 0; i < input_len; i++)
+        *p++ = rng() % 4 ? ' ' + rng() % 95 : rng();
+    for (size_t i = 0; i < words; i++)
+    {
+        uint16_t word = i + 1 == words ? enc_trap(TRAP_HALT) : random_word();
+        *p++ = word >> 8;
+        *p++ = word & 0xFF;
+    }
+    return p - data;
+}
+
+int replay(const char *path)
+{
+    FILE *file = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    if (!file)
+    {
+        printf("failed to open: %s\n", path);
+        return 0;
+    }
+
+    size_t cap = 1 << 16, size = 0;
+    uint8_t *data = malloc(cap);
+    size_t n;
+    while ((n = fread(data + size, 1, cap - size, file)) > 0)
+    {
+        size += n;
+        if (size == cap)
+            data = realloc(data, cap *= 2);
+    }
+    if (file != stdin)
+        fclose(file);
+
+    fuzz_one(data, size);
+    free(data);
+    return 1;
+}
+
+int main(int argc, const char *argv[])
+{
+    uint64_t iterations = FUZZ_ITERATIONS;
+    uint64_t seed = time(NULL);
+    int replayed = 0;
+
+    for (int j = 1; j < argc; j++)
+    {
+        if (strcmp(argv[j], "-n") == 0 && j + 1 < argc)
+        {
+            iterations = strtoull(argv[++j], NULL, 0);
+        }
+        else if (strcmp(argv[j], "-s") == 0 && j + 1 < argc)
+        {
+            seed = strtoull(argv[++j], NULL, 0);
+        }
+        else if (strcmp(argv[j], "-b") == 0 && j + 1 < argc)
+        {
+            fuzz_budget = strtoull(argv[++j], NULL, 0);
+        }
+        else if (strcmp(argv[j], "-o") == 0 && j + 1 < argc)
+        {
+            failure_path = argv[++j];
+        }
+        else if (argv[j][0] != '-' || strcmp(argv[j], "-") == 0)
+        {
+            if (!replay(argv[j]))
+                exit(2);
+            replayed++;
+        }
+        else
+        {
+            printf("fuzz [-n iterations] [-s seed] [-b budget] [-o failure] [file ..]\n");
+            exit(2);
+        }
+    }
+    if (replayed)
+    {
+        printf("%d inputs agree with the reference\n", replayed);
+        return 0;
+    }
+
+    printf("fuzzing %d engines, seed %llu\n", ENGINE_COUNT, (unsigned long long)seed);
+    uint8_t data[2 + INPUT_LENGTH + 2 * PROGRAM_LENGTH];
+    rng_state = seed | 1;
+    for (uint64_t i = 0; i < iterations; i++)
+        fuzz_one(data, random_input(data));
+    printf("%llu programs agree with the reference\n", (unsigned long long)iterations);
+    return 0;
+}
+#endif
@@ -0,0 +1,239 @@
+// A second LC-3, written from the ISA and not from vm_run, for fuzz.c to compare
+// against. It is as plain as it gets: one instruction per ref_step(), no idle
+// detection, no probes, input and output in memory. Where vm_run deliberately differs
+// from the LC-3 it follows vm_run:
+//
+//   - the TRAP routines are native. R7 gets the return address, unknown vectors do
+//     nothing, GETC and IN return xFFFF at the end of input
+//   - LEA sets the condition codes, as in the first edition of the ISA
+//   - RES and RTI stop the machine, there is no supervisor mode
+//   - reading KBSR consumes a character into KBDR whenever one is ready, and the end
+//     of input counts as ready
+//
+// Include after src/vm.c
+#ifndef REFERENCE_H
+#define REFERENCE_H
+
+enum
+{
+    REF_RUNNING = -1,
+    REF_DIRTY_MAX = 4096, // Writes logged between two ref_dirty_clear(), then ref_dirty_all is set
+};
+
+struct reference
+{
+    uint16_t memory[1 << 16];
+    uint16_t reg[8];
+    uint16_t pc;
+    uint16_t cond;
+    uint64_t instret;
+    int status; // REF_RUNNING, VM_HALTED or VM_ILLEGAL
+
+    const uint8_t *input;
+    size_t input_len;
+    size_t input_pos;
+
+    uint8_t *output;
+    size_t output_len;
+    size_t output_cap;
+
+    // Addresses written since the last compare
+    uint16_t dirty[REF_DIRTY_MAX];
+    int dirty_count;
+    int dirty_all;
+};
+
+static struct reference ref;
+
+static void ref_reset(const uint8_t *input, size_t input_len)
+{
+    uint8_t *output = ref.output;
+    size_t output_cap = ref.output_cap;
+
+    memset(&ref, 0, sizeof(ref));
+    ref.pc = 0x3000;
+    ref.cond = FL_ZRO;
+    ref.status = REF_RUNNING;
+    ref.input = input;
+    ref.input_len = input_len;
+    ref.output = output;
+    ref.output_cap = output_cap;
+}
+
+static void ref_store(uint16_t addr, uint16_t val)
+{
+    ref.memory[addr] = val;
+    if (ref.dirty_count < REF_DIRTY_MAX)
+        ref.dirty[ref.dirty_count++] = addr;
+    else
+        ref.dirty_all = 1;
+}
+
+static void ref_dirty_clear(void)
+{
+    ref.dirty_count = 0;
+    ref.dirty_all = 0;
+}
+
+static uint16_t ref_getc(void)
+{
+    if (ref.input_pos == ref.input_len)
+        return 0xFFFF;
+    return ref.input[ref.input_pos++];
+}
+
+static void ref_putc(uint8_t c)
+{
+    if (ref.output_len == ref.output_cap)
+    {
+        ref.output_cap = ref.output_cap ? ref.output_cap * 2 : 256;
+        ref.output = realloc(ref.output, ref.output_cap);
+    }
+    ref.output[ref.output_len++] = c;
+}
+
+static void ref_puts(const char *s)
+{
+    while (*s)
+        ref_putc((uint8_t)*s++);
+}
+
+// Loads and fetches go through here. Input in memory is always ready
+static uint16_t ref_load(uint16_t addr)
+{
+    if (addr == MR_KBSR)
+    {
+        ref_store(MR_KBSR, 0x8000);
+        ref_store(MR_KBDR, ref_getc());
+    }
+    return ref.memory[addr];
+}
+
+static uint16_t ref_sext(uint16_t x, int bits)
+{
+    uint16_t sign = 1 << (bits - 1);
+    x &= (1 << bits) - 1;
+    return (x ^ sign) - sign;
+}
+
+static void ref_setcc(uint16_t value)
+{
+    if (value == 0)
+        ref.cond = FL_ZRO;
+    else if (value & 0x8000)
+        ref.cond = FL_NEG;
+    else
+        ref.cond = FL_POS;
+}
+
+static void ref_trap(uint16_t vector)
+{
+    ref.reg[7] = ref.pc;
+
+    switch (vector)
+    {
+    case TRAP_GETC:
+        ref.reg[0] = ref_getc();
+        break;
+    case TRAP_OUT:
+        ref_putc(ref.reg[0] & 0xFF);
+        break;
+    case TRAP_PUTS:
+        for (uint16_t a = ref.reg[0]; ref.memory[a]; a++)
+            ref_putc(ref.memory[a] & 0xFF);
+        break;
+    case TRAP_IN:
+        ref_puts("Enter a character: ");
+        ref.reg[0] = ref_getc();
+        if (ref.reg[0] != 0xFFFF)
+            ref_putc(ref.reg[0]);
+        break;
+    case TRAP_PUTSP:
+        for (uint16_t a = ref.reg[0]; ref.memory[a]; a++)
+        {
+            ref_putc(ref.memory[a] & 0xFF);
+            if (ref.memory[a] >> 8)
+                ref_putc(ref.memory[a] >> 8);
+        }
+        break;
+    case TRAP_HALT:
+        ref_puts("HALT\n");
+        ref.status = VM_HALTED;
+        break;
+    }
+}
+
+// Execute one instruction
+static void ref_step(void)
+{
+    uint16_t ir = ref_load(ref.pc);
+    ref.pc++;
+    ref.instret++;
+
+    uint16_t dr = (ir >> 9) & 7;
+    uint16_t sr1 = (ir >> 6) & 7;
+    uint16_t src2 = (ir & 0x20) ? ref_sext(ir, 5) : ref.reg[ir & 7];
+
+    switch (ir >> 12)
+    {
+    case OP_BR:
+        if (dr & ref.cond)
+            ref.pc += ref_sext(ir, 9);
+        break;
+    case OP_ADD:
+        ref.reg[dr] = ref.reg[sr1] + src2;
+        ref_setcc(ref.reg[dr]);
+        break;
+    case OP_AND:
+        ref.reg[dr] = ref.reg[sr1] & src2;
+        ref_setcc(ref.reg[dr]);
+        break;
+    case OP_NOT:
+        ref.reg[dr] = ~ref.reg[sr1];
+        ref_setcc(ref.reg[dr]);
+        break;
+    case OP_LD:
+        ref.reg[dr] = ref_load(ref.pc + ref_sext(ir, 9));
+        ref_setcc(ref.reg[dr]);
+        break;
+    case OP_LDI:
+        ref.reg[dr] = ref_load(ref_load(ref.pc + ref_sext(ir, 9)));
+        ref_setcc(ref.reg[dr]);
+        break;
+    case OP_LDR:
+        ref.reg[dr] = ref_load(ref.reg[sr1] + ref_sext(ir, 6));
+        ref_setcc(ref.reg[dr]);
+        break;
+    case OP_LEA:
+        ref.reg[dr] = ref.pc + ref_sext(ir, 9);
+        ref_setcc(ref.reg[dr]);
+        break;
+    case OP_ST:
+        ref_store(ref.pc + ref_sext(ir, 9), ref.reg[dr]);
+        break;
+    case OP_STI:
+        ref_store(ref_load(ref.pc + ref_sext(ir, 9)), ref.reg[dr]);
+        break;
+    case OP_STR:
+        ref_store(ref.reg[sr1] + ref_sext(ir, 6), ref.reg[dr]);
+        break;
+    case OP_JMP:
+        ref.pc = ref.reg[sr1];
+        break;
+    case OP_JSR:
+    {
+        uint16_t target = (ir & 0x800) ? ref.pc + ref_sext(ir, 11) : ref.reg[sr1];
+        ref.reg[7] = ref.pc;
+        ref.pc = target;
+    }
+    break;
+    case OP_TRAP:
+        ref_trap(ir & 0xFF);
+        break;
+    default:
+        ref.status = VM_ILLEGAL;
+        break;
+    }
+}
+
+#endif
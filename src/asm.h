@@ -0,0 +1,619 @@
+// LC-3 assembler for `lc3 asm` and for programs that build guests in memory. It takes
+// the lc3as dialect: one .ORIG .. .END block, .FILL, .BLKW, .STRINGZ, labels, ; comments,
+// #decimal, xhex and bbinary numbers and the TRAP aliases. Numbers given for PC
+// relative operands are offsets, labels are turned into offsets.
+//
+// Two passes over the source: the first gives every label its address, the second
+// encodes. Each pass tokenizes its own copy of the source, so nothing is kept between
+// them but the labels.
+#ifndef ASM_H
+#define ASM_H
+
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+struct asm_label
+{
+    uint16_t addr;
+    char *name;
+};
+
+struct asm_program
+{
+    uint16_t origin;
+    uint16_t *words;
+    size_t count;
+    struct asm_label *labels;
+    size_t label_count;
+    char error[128]; // The first error, "line 12: unknown label LOOP"
+};
+
+enum
+{
+    ASM_TOKENS = 8, // Label, mnemonic and operands on one line
+};
+
+// What a mnemonic assembles to
+enum asm_kind
+{
+    ASM_OPERATE, // ADD, AND
+    ASM_NOT,
+    ASM_BR,
+    ASM_JMP,
+    ASM_RET,
+    ASM_JSR,
+    ASM_JSRR,
+    ASM_PC9,     // LD, LDI, LEA, ST, STI
+    ASM_BASE6,   // LDR, STR
+    ASM_TRAP,
+    ASM_TRAP_ALIAS,
+    ASM_RTI,
+    ASM_ORIG,
+    ASM_FILL,
+    ASM_BLKW,
+    ASM_STRINGZ,
+    ASM_END,
+};
+
+struct asm_mnemonic
+{
+    const char *name;
+    enum asm_kind kind;
+    uint16_t value; // Opcode, TRAP vector or BR condition
+};
+
+// State of one pass
+struct asm_pass
+{
+    struct asm_program *program;
+    int second; // Encoding, the labels are known
+    int line;
+    int started; // .ORIG seen
+    int ended;   // .END seen
+    uint32_t addr;
+};
+
+static inline int asm_fail(struct asm_pass *pass, const char *format, ...)
+{
+    struct asm_program *p = pass->program;
+    if (p->error[0])
+        return 0;
+
+    int n = snprintf(p->error, sizeof(p->error), "line %d: ", pass->line);
+    va_list args;
+    va_start(args, format);
+    vsnprintf(p->error + n, sizeof(p->error) - n, format, args);
+    va_end(args);
+    return 0;
+}
+
+// Look up an opcode, directive or TRAP alias. BR takes any of n, z and p in that order
+static inline const struct asm_mnemonic *asm_lookup(const char *name)
+{
+    static const struct asm_mnemonic mnemonics[] = {
+        {"ADD", ASM_OPERATE, 0x1},
+        {"AND", ASM_OPERATE, 0x5},
+        {"NOT", ASM_NOT, 0x9},
+        {"JMP", ASM_JMP, 0xC},
+        {"RET", ASM_RET, 0xC},
+        {"JSR", ASM_JSR, 0x4},
+        {"JSRR", ASM_JSRR, 0x4},
+        {"LD", ASM_PC9, 0x2},
+        {"LDI", ASM_PC9, 0xA},
+        {"LEA", ASM_PC9, 0xE},
+        {"ST", ASM_PC9, 0x3},
+        {"STI", ASM_PC9, 0xB},
+        {"LDR", ASM_BASE6, 0x6},
+        {"STR", ASM_BASE6, 0x7},
+        {"TRAP", ASM_TRAP, 0xF},
+        {"RTI", ASM_RTI, 0x8},
+        {"GETC", ASM_TRAP_ALIAS, 0x20},
+        {"OUT", ASM_TRAP_ALIAS, 0x21},
+        {"PUTS", ASM_TRAP_ALIAS, 0x22},
+        {"IN", ASM_TRAP_ALIAS, 0x23},
+        {"PUTSP", ASM_TRAP_ALIAS, 0x24},
+        {"HALT", ASM_TRAP_ALIAS, 0x25},
+        {".ORIG", ASM_ORIG, 0},
+        {".FILL", ASM_FILL, 0},
+        {".BLKW", ASM_BLKW, 0},
+        {".STRINGZ", ASM_STRINGZ, 0},
+        {".END", ASM_END, 0},
+    };
+    static const struct asm_mnemonic branches[8] = {
+        {"BR", ASM_BR, 7},
+        {"BRp", ASM_BR, 1},
+        {"BRz", ASM_BR, 2},
+        {"BRzp", ASM_BR, 3},
+        {"BRn", ASM_BR, 4},
+        {"BRnp", ASM_BR, 5},
+        {"BRnz", ASM_BR, 6},
+        {"BRnzp", ASM_BR, 7},
+    };
+
+    for (size_t i = 0; i < sizeof(mnemonics) / sizeof(mnemonics[0]); i++)
+    {
+        if (strcasecmp(name, mnemonics[i].name) == 0)
+            return &mnemonics[i];
+    }
+
+    if (strncasecmp(name, "BR", 2) == 0)
+    {
+        // Plain BR, without n, z or p, is BRnzp
+        int cond = 0;
+        const char *c = name + 2;
+        if (tolower(*c) == 'n')
+            cond |= 4, c++;
+        if (tolower(*c) == 'z')
+            cond |= 2, c++;
+        if (tolower(*c) == 'p')
+            cond |= 1, c++;
+        if (*c == '\0')
+            return &branches[cond];
+    }
+    return NULL;
+}
+
+// Split line into tokens in place. Commas separate like spaces, a quoted string is one
+// token with its quotes
+static inline int asm_tokenize(char *line, char *tokens[ASM_TOKENS])
+{
+    int n = 0;
+    char *c = line;
+    while (n < ASM_TOKENS + 1)
+    {
+        while (*c == ' ' || *c == '\t' || *c == ',' || *c == '\r')
+            c++;
+        if (*c == '\0' || *c == ';')
+            break;
+        if (n == ASM_TOKENS)
+            return -1;
+
+        tokens[n++] = c;
+        if (*c == '"')
+        {
+            for (c++; *c && *c != '"'; c++)
+            {
+                if (*c == '\\' && c[1])
+                    c++;
+            }
+            if (*c == '"')
+                c++;
+        }
+        else
+        {
+            while (*c && *c != ' ' && *c != '\t' && *c != ',' && *c != '\r' && *c != ';')
+                c++;
+        }
+
+        // Terminate the token, a comment right after it still ends the line
+        char end = *c;
+        if (end)
+            *c++ = '\0';
+        if (end == ';')
+            break;
+    }
+    return n;
+}
+
+// Parse #decimal, xhex, bbinary or plain decimal
+static inline int asm_number(const char *s, long *value)
+{
+    int base = 10;
+    if (*s == '#')
+        s++;
+    else if (*s == 'x' || *s == 'X')
+        base = 16, s++;
+    else if ((*s == 'b' || *s == 'B') && (s[1] == '0' || s[1] == '1' || s[1] == '-'))
+        base = 2, s++;
+
+    const char *digits = *s == '-' ? s + 1 : s;
+    if (*digits == '\0')
+        return 0;
+    for (const char *d = digits; *d; d++)
+    {
+        if (base == 16 ? !isxdigit((unsigned char)*d) : !(*d >= '0' && *d < '0' + base))
+            return 0;
+    }
+    *value = strtol(s, NULL, base);
+    return 1;
+}
+
+static inline int asm_is_register(const char *s)
+{
+    return (s[0] == 'R' || s[0] == 'r') && s[1] >= '0' && s[1] <= '7' && s[2] == '\0';
+}
+
+static inline int asm_register(struct asm_pass *pass, const char *s, int *r)
+{
+    if (!asm_is_register(s))
+        return asm_fail(pass, "expected a register, got %s", s);
+    *r = s[1] - '0';
+    return 1;
+}
+
+static inline int asm_find_label(struct asm_program *p, const char *name, uint16_t *addr)
+{
+    for (size_t i = 0; i < p->label_count; i++)
+    {
+        if (strcmp(p->labels[i].name, name) == 0)
+        {
+            *addr = p->labels[i].addr;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// A number that fits in bits, signed or, when allowed, unsigned
+static inline int asm_immediate(struct asm_pass *pass, const char *s, int bits, int allow_unsigned, int *value)
+{
+    long v;
+    if (!asm_number(s, &v))
+        return asm_fail(pass, "expected a number, got %s", s);
+
+    long min = -(1L << (bits - 1));
+    long max = allow_unsigned ? (1L << bits) - 1 : (1L << (bits - 1)) - 1;
+    if (v < min || v > max)
+        return asm_fail(pass, "%s does not fit in %d bits", s, bits);
+    *value = (int)(v & ((1 << bits) - 1));
+    return 1;
+}
+
+// A PC relative operand, a label or an offset from the incremented PC
+static inline int asm_offset(struct asm_pass *pass, const char *s, int bits, int *value)
+{
+    long v;
+    uint16_t target;
+    if (asm_number(s, &v))
+    {
+        // Offsets are used as written
+    }
+    else if (!pass->second)
+    {
+        // Labels may be defined further down, the first pass only counts words
+        *value = 0;
+        return 1;
+    }
+    else if (asm_find_label(pass->program, s, &target))
+    {
+        v = (int16_t)(target - (uint16_t)(pass->addr + 1));
+    }
+    else
+    {
+        return asm_fail(pass, "unknown label %s", s);
+    }
+
+    if (v < -(1L << (bits - 1)) || v > (1L << (bits - 1)) - 1)
+        return asm_fail(pass, "%s is too far away for a %d bit offset", s, bits);
+    *value = (int)(v & ((1 << bits) - 1));
+    return 1;
+}
+
+// Undo the escapes of a quoted .STRINGZ operand in place, returns the length
+static inline int asm_string(struct asm_pass *pass, char *s, size_t *len)
+{
+    size_t n = strlen(s);
+    if (n < 2 || s[0] != '"' || s[n - 1] != '"')
+        return asm_fail(pass, "expected a quoted string, got %s", s);
+
+    char *out = s;
+    for (char *c = s + 1; c < s + n - 1; c++)
+    {
+        if (*c != '\\')
+        {
+            *out++ = *c;
+            continue;
+        }
+
+        switch (*++c)
+        {
+        case 'n':
+            *out++ = '\n';
+            break;
+        case 't':
+            *out++ = '\t';
+            break;
+        case 'r':
+            *out++ = '\r';
+            break;
+        case 'e':
+            *out++ = '\033';
+            break;
+        case '0':
+            *out++ = '\0';
+            break;
+        default:
+            *out++ = *c;
+            break;
+        }
+    }
+    *len = out - s;
+    return 1;
+}
+
+static inline int asm_operands(struct asm_pass *pass, const char *mnemonic, int given, int wanted)
+{
+    if (given == wanted)
+        return 1;
+    return asm_fail(pass, "%s takes %d operands, not %d", mnemonic, wanted, given);
+}
+
+// Put word at the current address, the first pass only counts it
+static inline int asm_emit(struct asm_pass *pass, uint16_t word)
+{
+    struct asm_program *p = pass->program;
+    if (pass->addr > UINT16_MAX)
+        return asm_fail(pass, "program runs past xFFFF");
+    if (pass->second)
+        p->words[pass->addr - p->origin] = word;
+    pass->addr++;
+    return 1;
+}
+
+static inline int asm_add_label(struct asm_pass *pass, const char *name)
+{
+    struct asm_program *p = pass->program;
+    uint16_t addr;
+    long number;
+
+    if (!pass->started)
+        return asm_fail(pass, "label %s before .ORIG", name);
+    if (asm_number(name, &number) || asm_is_register(name))
+        return asm_fail(pass, "%s is not a label name", name);
+    if (asm_find_label(p, name, &addr))
+        return asm_fail(pass, "label %s is defined twice", name);
+
+    p->labels = realloc(p->labels, (p->label_count + 1) * sizeof(*p->labels));
+    p->labels[p->label_count].addr = pass->addr;
+    p->labels[p->label_count].name = strdup(name);
+    p->label_count++;
+    return 1;
+}
+
+// Assemble one line
+static inline int asm_line(struct asm_pass *pass, char *line)
+{
+    char *t[ASM_TOKENS];
+    int n = asm_tokenize(line, t);
+    if (n < 0)
+        return asm_fail(pass, "too many operands");
+    if (n == 0 || pass->ended)
+        return 1;
+
+    // A line starts with a label unless it starts with a mnemonic
+    const struct asm_mnemonic *m = asm_lookup(t[0]);
+    int first = 0;
+    if (!m)
+    {
+        if (!pass->second && !asm_add_label(pass, t[0]))
+            return 0;
+        if (n == 1)
+            return 1;
+
+        first = 1;
+        m = asm_lookup(t[1]);
+        if (!m)
+            return asm_fail(pass, "unknown instruction %s", t[1]);
+    }
+
+    char **op = t + first + 1;
+    int ops = n - first - 1;
+    int r0 = 0, r1 = 0, r2 = 0, v = 0;
+
+    if (m->kind == ASM_ORIG)
+    {
+        if (pass->started)
+            return asm_fail(pass, "only one .ORIG block is supported");
+        if (first)
+            return asm_fail(pass, "label %s before .ORIG", t[0]);
+        if (!asm_operands(pass, m->name, ops, 1) || !asm_immediate(pass, op[0], 16, 1, &v))
+            return 0;
+
+        pass->started = 1;
+        pass->addr = v;
+        pass->program->origin = v;
+        return 1;
+    }
+    if (!pass->started)
+        return asm_fail(pass, "%s before .ORIG", t[first]);
+
+    switch (m->kind)
+    {
+    case ASM_OPERATE:
+        if (!asm_operands(pass, m->name, ops, 3) || !asm_register(pass, op[0], &r0) ||
+            !asm_register(pass, op[1], &r1))
+            return 0;
+        if (asm_is_register(op[2]))
+        {
+            asm_register(pass, op[2], &r2);
+            return asm_emit(pass, m->value << 12 | r0 << 9 | r1 << 6 | r2);
+        }
+        if (!asm_immediate(pass, op[2], 5, 0, &v))
+            return 0;
+        return asm_emit(pass, m->value << 12 | r0 << 9 | r1 << 6 | 0x20 | v);
+    case ASM_NOT:
+        if (!asm_operands(pass, m->name, ops, 2) || !asm_register(pass, op[0], &r0) ||
+            !asm_register(pass, op[1], &r1))
+            return 0;
+        return asm_emit(pass, m->value << 12 | r0 << 9 | r1 << 6 | 0x3F);
+    case ASM_BR:
+        if (!asm_operands(pass, "BR", ops, 1) || !asm_offset(pass, op[0], 9, &v))
+            return 0;
+        return asm_emit(pass, m->value << 9 | v);
+    case ASM_JMP:
+    case ASM_JSRR:
+        if (!asm_operands(pass, m->name, ops, 1) || !asm_register(pass, op[0], &r1))
+            return 0;
+        return asm_emit(pass, m->value << 12 | r1 << 6);
+    case ASM_RET:
+        if (!asm_operands(pass, m->name, ops, 0))
+            return 0;
+        return asm_emit(pass, m->value << 12 | 7 << 6);
+    case ASM_JSR:
+        if (!asm_operands(pass, m->name, ops, 1) || !asm_offset(pass, op[0], 11, &v))
+            return 0;
+        return asm_emit(pass, m->value << 12 | 1 << 11 | v);
+    case ASM_PC9:
+        if (!asm_operands(pass, m->name, ops, 2) || !asm_register(pass, op[0], &r0) ||
+            !asm_offset(pass, op[1], 9, &v))
+            return 0;
+        return asm_emit(pass, m->value << 12 | r0 << 9 | v);
+    case ASM_BASE6:
+        if (!asm_operands(pass, m->name, ops, 3) || !asm_register(pass, op[0], &r0) ||
+            !asm_register(pass, op[1], &r1) || !asm_immediate(pass, op[2], 6, 0, &v))
+            return 0;
+        return asm_emit(pass, m->value << 12 | r0 << 9 | r1 << 6 | v);
+    case ASM_TRAP:
+    {
+        long vector;
+        if (!asm_operands(pass, m->name, ops, 1))
+            return 0;
+        if (!asm_number(op[0], &vector) || vector < 0 || vector > 0xFF)
+            return asm_fail(pass, "TRAP vector %s is out of range", op[0]);
+        return asm_emit(pass, m->value << 12 | vector);
+    }
+    case ASM_TRAP_ALIAS:
+        if (!asm_operands(pass, m->name, ops, 0))
+            return 0;
+        return asm_emit(pass, 0xF000 | m->value);
+    case ASM_RTI:
+        if (!asm_operands(pass, m->name, ops, 0))
+            return 0;
+        return asm_emit(pass, m->value << 12);
+    case ASM_FILL:
+    {
+        uint16_t addr;
+        long number;
+        if (!asm_operands(pass, m->name, ops, 1))
+            return 0;
+        if (asm_number(op[0], &number))
+        {
+            if (!asm_immediate(pass, op[0], 16, 1, &v))
+                return 0;
+        }
+        else if (!pass->second)
+        {
+            v = 0;
+        }
+        else if (asm_find_label(pass->program, op[0], &addr))
+        {
+            v = addr;
+        }
+        else
+        {
+            return asm_fail(pass, "unknown label %s", op[0]);
+        }
+        return asm_emit(pass, v);
+    }
+    case ASM_BLKW:
+        if (!asm_operands(pass, m->name, ops, 1) || !asm_immediate(pass, op[0], 16, 1, &v))
+            return 0;
+        while (v-- > 0)
+        {
+            if (!asm_emit(pass, 0))
+                return 0;
+        }
+        return 1;
+    case ASM_STRINGZ:
+    {
+        size_t len = 0;
+        if (!asm_operands(pass, m->name, ops, 1) || !asm_string(pass, op[0], &len))
+            return 0;
+        for (size_t i = 0; i < len; i++)
+        {
+            if (!asm_emit(pass, (uint8_t)op[0][i]))
+                return 0;
+        }
+        return asm_emit(pass, 0);
+    }
+    case ASM_END:
+        pass->ended = 1;
+        return 1;
+    default:
+        return 1;
+    }
+}
+
+static inline int asm_pass(struct asm_pass *pass, const char *source, size_t len)
+{
+    char *text = malloc(len + 1);
+    memcpy(text, source, len);
+    text[len] = '\0';
+
+    int ok = 1;
+    char *line = text;
+    for (pass->line = 1; ok && line; pass->line++)
+    {
+        char *next = strchr(line, '\n');
+        if (next)
+            *next++ = '\0';
+        ok = asm_line(pass, line);
+        line = next;
+    }
+    free(text);
+
+    if (ok && !pass->started)
+        return asm_fail(pass, "no .ORIG");
+    return ok;
+}
+
+static inline void asm_free(struct asm_program *p)
+{
+    for (size_t i = 0; i < p->label_count; i++)
+        free(p->labels[i].name);
+    free(p->labels);
+    free(p->words);
+    memset(p, 0, sizeof(*p));
+}
+
+// Assemble len bytes of source into p, which the caller frees with asm_free(). Returns
+// 0 with the reason in p->error when the source has an error
+static inline int assemble(const char *source, size_t len, struct asm_program *p)
+{
+    memset(p, 0, sizeof(*p));
+
+    // Find the labels and the size of the program
+    struct asm_pass pass = {.program = p};
+    if (!asm_pass(&pass, source, len))
+        return 0;
+    p->count = pass.addr - p->origin;
+    p->words = calloc(p->count ? p->count : 1, sizeof(*p->words));
+
+    // Encode, now that every label is known
+    pass = (struct asm_pass){.program = p, .second = 1};
+    return asm_pass(&pass, source, len);
+}
+
+// Write the image as read_image_file() reads it, a big-endian origin and words
+static inline int asm_write_obj(const struct asm_program *p, FILE *file)
+{
+    uint8_t bytes[2] = {p->origin >> 8, p->origin & 0xFF};
+    if (fwrite(bytes, 1, 2, file) != 2)
+        return 0;
+
+    for (size_t i = 0; i < p->count; i++)
+    {
+        bytes[0] = p->words[i] >> 8;
+        bytes[1] = p->words[i] & 0xFF;
+        if (fwrite(bytes, 1, 2, file) != 2)
+            return 0;
+    }
+    return 1;
+}
+
+// Write the labels in the format of lc3as, which read_symbols() reads back
+static inline int asm_write_sym(const struct asm_program *p, FILE *file)
+{
+    fprintf(file, "// Symbol table\n// Scope level 0:\n");
+    fprintf(file, "//\tSymbol Name       Page Address\n//\t----------------  ------------\n");
+    for (size_t i = 0; i < p->label_count; i++)
+        fprintf(file, "//\t%-16s  %04X\n", p->labels[i].name, p->labels[i].addr);
+    return fprintf(file, "\n") > 0;
+}
+
+#endif
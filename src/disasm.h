@@ -0,0 +1,92 @@
+// LC-3 disassembler shared by the VM's reports and the tools
+#ifndef DISASM_H
+#define DISASM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+static inline int disasm_sext(uint16_t x, int bit_count)
+{
+    return (x >> (bit_count - 1)) & 1 ? (int)x - (1 << bit_count) : (int)x;
+}
+
+// Write the assembly for instruction at address pc into buf. PC relative operands are
+// shown as absolute addresses
+static inline void disassemble(uint16_t pc, uint16_t instruction, char *buf, size_t size)
+{
+    static const char *mnemonics[16] = {
+        "BR", "ADD", "LD", "ST", "JSR", "AND", "LDR", "STR",
+        "RTI", "NOT", "LDI", "STI", "JMP", "RES", "LEA", "TRAP",
+    };
+    static const char *traps[] = {"GETC", "OUT", "PUTS", "IN", "PUTSP", "HALT"};
+    const char *name = mnemonics[instruction >> 12];
+
+    int r0 = (instruction >> 9) & 0x7;
+    int r1 = (instruction >> 6) & 0x7;
+    int r2 = instruction & 0x7;
+    uint16_t next = pc + 1;
+
+    switch (instruction >> 12)
+    {
+    case 0x0: // BR
+    {
+        int cond = (instruction >> 9) & 0x7;
+        if (!cond)
+            snprintf(buf, size, "NOP");
+        else
+            snprintf(buf, size, "BR%s%s%s x%04X", cond & 4 ? "n" : "", cond & 2 ? "z" : "", cond & 1 ? "p" : "",
+                     (uint16_t)(next + disasm_sext(instruction & 0x1FF, 9)));
+    }
+    break;
+    case 0x1: // ADD
+    case 0x5: // AND
+        if ((instruction >> 5) & 0x1)
+            snprintf(buf, size, "%s R%d, R%d, #%d", name, r0, r1, disasm_sext(instruction & 0x1F, 5));
+        else
+            snprintf(buf, size, "%s R%d, R%d, R%d", name, r0, r1, r2);
+        break;
+    case 0x2: // LD
+    case 0x3: // ST
+    case 0xA: // LDI
+    case 0xB: // STI
+    case 0xE: // LEA
+        snprintf(buf, size, "%s R%d, x%04X", name, r0, (uint16_t)(next + disasm_sext(instruction & 0x1FF, 9)));
+        break;
+    case 0x4: // JSR, JSRR
+        if ((instruction >> 11) & 0x1)
+            snprintf(buf, size, "JSR x%04X", (uint16_t)(next + disasm_sext(instruction & 0x7FF, 11)));
+        else
+            snprintf(buf, size, "JSRR R%d", r1);
+        break;
+    case 0x6: // LDR
+    case 0x7: // STR
+        snprintf(buf, size, "%s R%d, R%d, #%d", name, r0, r1, disasm_sext(instruction & 0x3F, 6));
+        break;
+    case 0x8: // RTI
+        snprintf(buf, size, "%s", name);
+        break;
+    case 0x9: // NOT
+        snprintf(buf, size, "NOT R%d, R%d", r0, r1);
+        break;
+    case 0xC: // JMP, RET
+        if (r1 == 7)
+            snprintf(buf, size, "RET");
+        else
+            snprintf(buf, size, "JMP R%d", r1);
+        break;
+    case 0xD: // Reserved
+        snprintf(buf, size, ".FILL x%04X", instruction);
+        break;
+    case 0xF: // TRAP
+    {
+        int vector = instruction & 0xFF;
+        if (vector >= 0x20 && vector <= 0x25)
+            snprintf(buf, size, "%s", traps[vector - 0x20]);
+        else
+            snprintf(buf, size, "TRAP x%02X", vector);
+    }
+    break;
+    }
+}
+
+#endif
@@ -0,0 +1,47 @@
+// USDT probes of provider lc3, for bpftrace, perf and other tools that attach to
+// SystemTap style static tracepoints:
+//
+//   image__load__start                 read_image_file begins
+//   image__load__end  origin, words    the image was placed at origin
+//   trap__entry       vector, pc       TRAP executes at pc
+//   trap__exit        vector, r0       the trap routine returns
+//   halt              instret          HALT after instret instructions
+//   block__entry      pc               control transferred to pc by BR, JMP or JSR,
+//                                      only in builds with -DLC3_USDT_BLOCKS
+//
+// An unattached probe is a single nop. Without <sys/sdt.h> (systemtap-sdt-dev) the
+// probes compile to nothing. Example:
+//
+//   bpftrace -e 'usdt:./lc3:lc3:trap__entry { @[arg0] = count(); }'
+#ifndef PROBES_H
+#define PROBES_H
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define LC3_HAVE_SDT
+#endif
+#endif
+
+#ifdef LC3_HAVE_SDT
+#define LC3_PROBE0(name) STAP_PROBE(lc3, name)
+#define LC3_PROBE1(name, a) STAP_PROBE1(lc3, name, a)
+#define LC3_PROBE2(name, a, b) STAP_PROBE2(lc3, name, a, b)
+#else
+#define LC3_PROBE0(name)
+#define LC3_PROBE1(name, a)
+#define LC3_PROBE2(name, a, b)
+#endif
+
+// One probe per taken branch costs a few percent even when unattached, so it is opt in.
+// Programs that embed the VM can define LC3_BLOCK_HOOK(pc) to a C call instead, as
+// fuzz/fuzz.c does
+#if defined(LC3_BLOCK_HOOK)
+#define LC3_PROBE_BLOCK(pc) LC3_BLOCK_HOOK(pc)
+#elif defined(LC3_USDT_BLOCKS)
+#define LC3_PROBE_BLOCK(pc) LC3_PROBE1(block__entry, pc)
+#else
+#define LC3_PROBE_BLOCK(pc)
+#endif
+
+#endif
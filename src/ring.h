@@ -0,0 +1,122 @@
+// Console ring buffers shared with other processes
+//
+// A ring lives in its own POSIX shared memory segment: this header followed by the
+// data. There is a single producer and a single consumer. The producer only stores
+// head and the consumer only stores tail, both count bytes and wrap at 2^32.
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+enum
+{
+    RING_MAGIC = 0x4c335247, // "LC3R"
+};
+
+struct ring
+{
+    uint32_t magic;
+    uint32_t size;              // Bytes of data, a power of two
+    uint32_t closed;            // Producer is done, everything it wrote is published
+    uint32_t waiting;           // Consumer is about to sleep and wants a wake up
+    uint32_t event;             // Futex word, bumped by the producer on every wake up
+    uint32_t pad;
+    uint64_t dropped;           // Bytes the producer discarded because the ring was full
+    _Alignas(64) uint32_t head; // Bytes written
+    _Alignas(64) uint32_t tail; // Bytes read
+    _Alignas(64) uint8_t data[];
+};
+
+// Map the ring segment NAME. A non zero size creates the segment, otherwise it must exist
+static inline struct ring *ring_open(const char *name, uint32_t size)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "%s%s", name[0] == '/' ? "" : "/", name);
+
+    int fd = size ? shm_open(path, O_RDWR | O_CREAT | O_TRUNC, 0600) : shm_open(path, O_RDWR, 0);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if ((size && ftruncate(fd, sizeof(struct ring) + size) < 0) || fstat(fd, &st) < 0)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    struct ring *r = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (r == MAP_FAILED)
+        return NULL;
+
+    if (size)
+    {
+        r->size = size;
+        __atomic_store_n(&r->magic, RING_MAGIC, __ATOMIC_RELEASE);
+    }
+    else if (__atomic_load_n(&r->magic, __ATOMIC_ACQUIRE) != RING_MAGIC)
+    {
+        munmap(r, st.st_size);
+        return NULL;
+    }
+    return r;
+}
+
+static inline void ring_close(struct ring *r)
+{
+    munmap(r, sizeof(struct ring) + r->size);
+}
+
+static inline void ring_unlink(const char *name)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "%s%s", name[0] == '/' ? "" : "/", name);
+    shm_unlink(path);
+}
+
+static inline void ring_wake(struct ring *r)
+{
+    __atomic_add_fetch(&r->event, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &r->event, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+// Producer side: make everything up to head visible, waking a sleeping consumer.
+// Costs no syscall unless the consumer is asleep
+static inline void ring_publish(struct ring *r, uint32_t head)
+{
+    __atomic_store_n(&r->head, head, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&r->waiting, __ATOMIC_SEQ_CST) && __atomic_exchange_n(&r->waiting, 0, __ATOMIC_SEQ_CST))
+        ring_wake(r);
+}
+
+// Producer side: publish head, no more data will follow
+static inline void ring_finish(struct ring *r, uint32_t head)
+{
+    __atomic_store_n(&r->head, head, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&r->closed, 1, __ATOMIC_SEQ_CST);
+    ring_wake(r);
+}
+
+// Consumer side: sleep until head moves past tail, the producer closes the ring or
+// timeout passes. A NULL timeout waits for good
+static inline void ring_wait_for(struct ring *r, uint32_t tail, const struct timespec *timeout)
+{
+    uint32_t event = __atomic_load_n(&r->event, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&r->waiting, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&r->head, __ATOMIC_SEQ_CST) == tail && !__atomic_load_n(&r->closed, __ATOMIC_SEQ_CST))
+        syscall(SYS_futex, &r->event, FUTEX_WAIT, event, timeout, NULL, 0);
+}
+
+static inline void ring_wait(struct ring *r, uint32_t tail)
+{
+    ring_wait_for(r, tail, NULL);
+}
+
+#endif
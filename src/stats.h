@@ -0,0 +1,139 @@
+// Live counters of a running VM, published by --stats-shm and read by tools/lc3top.c
+//
+// The counters live in their own POSIX shared memory segment. The VM is the only
+// writer and guards every update with a sequence lock: it makes seq odd, stores the
+// fields and makes seq even again. Readers copy the fields and retry when seq was odd
+// or changed meanwhile, so they never hold up the writer.
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+enum
+{
+    STATS_MAGIC = 0x4c335354, // "LC3S"
+};
+
+// Values of stats_shm.state
+enum
+{
+    STATS_RUNNING,
+    STATS_EXITED,
+};
+
+struct stats_shm
+{
+    uint32_t magic;
+    uint32_t pid;
+    uint64_t seq;
+    uint64_t start_ns;       // CLOCK_MONOTONIC when the guest started
+    uint64_t update_ns;      // CLOCK_MONOTONIC of this update
+    uint64_t instret;        // Instructions executed
+    uint64_t traps;          // TRAPs executed
+    uint64_t jobs_completed; // Guests run to the end
+    uint64_t queue_depth;    // Guests waiting to run
+    uint32_t pc;
+    uint32_t state;
+};
+
+enum
+{
+    STATS_PATH_MAX = 256
+};
+
+// The shm_open path of the segment NAME
+static inline void stats_path(char path[STATS_PATH_MAX], const char *name)
+{
+    snprintf(path, STATS_PATH_MAX, "%s%s", name[0] == '/' ? "" : "/", name);
+}
+
+// Map the stats segment NAME, creating it when create is set
+static inline struct stats_shm *stats_open(const char *name, int create)
+{
+    char path[STATS_PATH_MAX];
+    stats_path(path, name);
+
+    int fd = create ? shm_open(path, O_RDWR | O_CREAT | O_TRUNC, 0644) : shm_open(path, O_RDONLY, 0);
+    if (fd < 0)
+        return NULL;
+
+    if (create && ftruncate(fd, sizeof(struct stats_shm)) < 0)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    struct stats_shm *s = mmap(NULL, sizeof(struct stats_shm), create ? PROT_READ | PROT_WRITE : PROT_READ,
+                               MAP_SHARED, fd, 0);
+    close(fd);
+    if (s == MAP_FAILED)
+        return NULL;
+
+    if (create)
+    {
+        s->pid = getpid();
+        __atomic_store_n(&s->magic, STATS_MAGIC, __ATOMIC_RELEASE);
+    }
+    else if (__atomic_load_n(&s->magic, __ATOMIC_ACQUIRE) != STATS_MAGIC)
+    {
+        munmap(s, sizeof(struct stats_shm));
+        return NULL;
+    }
+    return s;
+}
+
+static inline void stats_unlink(const char *name)
+{
+    char path[STATS_PATH_MAX];
+    stats_path(path, name);
+    shm_unlink(path);
+}
+
+// Writer side. Fields are stored between stats_write_begin and stats_write_end with
+// relaxed atomic stores, the fences order them against seq
+static inline void stats_write_begin(struct stats_shm *s)
+{
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void stats_write_end(struct stats_shm *s)
+{
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+// Reader side: take a consistent copy of s
+static inline void stats_read(const struct stats_shm *s, struct stats_shm *copy)
+{
+    for (;;)
+    {
+        uint64_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+            continue;
+
+        copy->magic = s->magic;
+        copy->pid = s->pid;
+        copy->start_ns = __atomic_load_n(&s->start_ns, __ATOMIC_RELAXED);
+        copy->update_ns = __atomic_load_n(&s->update_ns, __ATOMIC_RELAXED);
+        copy->instret = __atomic_load_n(&s->instret, __ATOMIC_RELAXED);
+        copy->traps = __atomic_load_n(&s->traps, __ATOMIC_RELAXED);
+        copy->jobs_completed = __atomic_load_n(&s->jobs_completed, __ATOMIC_RELAXED);
+        copy->queue_depth = __atomic_load_n(&s->queue_depth, __ATOMIC_RELAXED);
+        copy->pc = __atomic_load_n(&s->pc, __ATOMIC_RELAXED);
+        copy->state = __atomic_load_n(&s->state, __ATOMIC_RELAXED);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) == seq)
+        {
+            copy->seq = seq;
+            return;
+        }
+    }
+}
+
+#endif
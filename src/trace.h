@@ -0,0 +1,56 @@
+// Execution trace format, written by --trace and read by tools/lc3trace.c
+//
+// A trace starts with the 8 bytes of TRACE_MAGIC, followed by one record per executed
+// instruction. Every record starts with a tag byte:
+//
+//   1nnnnnnn  n + 1 plain records. A plain record has the PC after the previous one,
+//             the same instruction as the last time its PC was traced and no memory
+//             access
+//   00000mip  one record, followed by the fields whose bits are set, in this order:
+//             p  PC, zigzag varint delta from the previous PC + 1
+//             i  instruction, 2 bytes little endian
+//             m  access of LD/LDI/LDR/ST/STI/STR: address as a zigzag varint delta
+//                from the previous access, then the value as a varint
+//
+// Writer and reader both remember the last instruction traced at every address,
+// starting from all zeros, and both start with the previous PC and access at 0.
+// Trap vectors and the direction of an access follow from the instruction.
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#define TRACE_MAGIC "LC3TRC01"
+
+enum
+{
+    TRACE_PC = 1 << 0,
+    TRACE_INSN = 1 << 1,
+    TRACE_MEM = 1 << 2,
+    TRACE_RUN = 1 << 7,
+    TRACE_RUN_MAX = 128,
+};
+
+static inline uint8_t *trace_put_varint(uint8_t *p, uint32_t v)
+{
+    while (v >= 0x80)
+    {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static inline uint32_t trace_zigzag(uint16_t delta)
+{
+    int16_t d = (int16_t)delta;
+    return (uint16_t)((d << 1) ^ (d >> 15));
+}
+
+static inline uint16_t trace_unzigzag(uint32_t v)
+{
+    return (uint16_t)((v >> 1) ^ -(v & 1));
+}
+
+#endif
@@ -1,6 +1,32 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <termios.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <linux/io_uring.h>
+#include <linux/perf_event.h>
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+#include "asm.h"
+#include "disasm.h"
+#include "probes.h"
+#include "ring.h"
+#include "stats.h"
+#include "trace.h"
 
 // Registers
 enum
@@ -58,118 +84,2507 @@ enum
     TRAP_HALT = 0x25,  // Halt program
 };
 
-uint16_t memory[UINT16_MAX];
-uint16_t registers[R_COUNT];
+// Instrumented builds (-DLC3_INSTRUMENT) count what the guest executes, see --stats.
+// Default builds compile the counting out of the execution loop entirely
+#ifdef LC3_INSTRUMENT
+#define INSTRUMENT(x) x
+#else
+#define INSTRUMENT(x)
+#endif
+
+// Instruction variants counted by --stats
+enum
+{
+    VAR_ADD_REG,
+    VAR_ADD_IMM,
+    VAR_AND_REG,
+    VAR_AND_IMM,
+    VAR_BR_TAKEN,
+    VAR_BR_NOT_TAKEN,
+    VAR_JMP,
+    VAR_RET,
+    VAR_JSR,
+    VAR_JSRR,
+    VAR_COUNT
+};
+
+const char *op_names[16] = {
+    "BR", "ADD", "LD", "ST", "JSR", "AND", "LDR", "STR",
+    "RTI", "NOT", "LDI", "STI", "JMP", "RES", "LEA", "TRAP",
+};
+
+const char *variant_names[VAR_COUNT] = {
+    "ADD reg", "ADD imm", "AND reg", "AND imm", "BR taken",
+    "BR not taken", "JMP", "RET", "JSR", "JSRR",
+};
+
+const char *trap_names[6] = {"GETC", "OUT", "PUTS", "IN", "PUTSP", "HALT"};
+
+// Memory mapped registers
+enum
+{
+    MR_KBSR = 0xFE00, // Keyboard status. Bit 15 is set when a key is ready
+    MR_KBDR = 0xFE02, // Keyboard data
+};
+
+// Pages of the --heatmap report are 1 << HEAT_PAGE_SHIFT words
+enum
+{
+    HEAT_PAGE_SHIFT = 6,
+    HEAT_PAGE_COUNT = (UINT16_MAX + 1) >> HEAT_PAGE_SHIFT,
+};
+
+// Longest backward branch (in words) considered for idle detection
+enum
+{
+    IDLE_LOOP_MAX = 16
+};
+
+// Execution trace buffers, see --trace. A record never takes more than TRACE_RECORD_MAX bytes
+enum
+{
+    TRACE_BUF_SIZE = 1 << 20,
+    TRACE_BUF_COUNT = 8,
+    TRACE_RECORD_MAX = 16,
+};
+
+// Deepest guest call stack tracked by --callgraph. Deeper calls count in the deepest frame
+enum
+{
+    CALL_DEPTH_MAX = 1024
+};
+
+// Default number of entries in ranked reports, see --top
+enum
+{
+    REPORT_TOP = 30
+};
+
+// Console channel kinds
+enum
+{
+    CHAN_STDIO,  // Process stdin/stdout through stdio
+    CHAN_MEMORY, // Memory buffer. Input ends with the buffer, output grows as needed
+    CHAN_FILE,   // File descriptor buffered by the channel itself
+    CHAN_RING,   // Shared memory ring, see ring.h
+};
+
+// Buffer size of file channels and default ring sizes
+enum
+{
+    CHAN_BUF_SIZE = 1 << 16,
+    RING_OUT_SIZE = 1 << 20,
+    RING_IN_SIZE = 1 << 16,
+};
+
+// Asynchronous I/O backends
+enum
+{
+    AIO_NONE,
+    AIO_URING,   // io_uring, completions are reaped from the ring without a syscall
+    AIO_THREADS, // read()/write() of ready fds on a shared pool of worker threads
+};
+
+enum
+{
+    AIO_RING_SIZE = 8, // Submission queue entries of each VM's ring
+    AIO_POOL_SIZE = 2,        // Worker threads of the thread pool backend
+    AIO_BATCH_SIZE = 1 << 14, // Output an async channel collects before an output trap submits it
+    AIO_POLL_MS = 10,         // How long a pool worker waits for a pipe before serving others
+};
+
+// A read or write handed to the async backend. A channel has at most one in flight
+struct aio_req
+{
+    int fd;
+    int write;
+    uint8_t *buf;
+    size_t len;
+    ssize_t res;          // Result of the read or write, negative on error
+    int busy;             // Submitted and not completed yet
+    int cancel;           // Thread pool: complete with -ECANCELED instead of waiting for the fd
+    struct aio_req *next; // Thread pool queue link
+};
+
+// io_uring queues shared with the kernel
+struct uring
+{
+    int fd;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    // The mappings, for uring_exit
+    void *sq_map, *cq_map, *sqes_map;
+    size_t sq_size, cq_size, sqes_size;
+};
+
+// Guest label from a .sym file
+struct symbol
+{
+    uint16_t addr;
+    char *name;
+};
+
+// Source of guest input or sink of guest output
+struct channel
+{
+    int kind;
+    int fd;              // Backing file of CHAN_FILE channels
+    uint8_t *buf;        // Buffered bytes
+    size_t len;          // Bytes used in buf
+    size_t pos;          // Read position of input channels
+    size_t cap;          // Allocated size of buf, 0 when the caller owns it
+    uint8_t *spare;      // Buffer the async backend reads into or writes from
+    struct aio_req *req; // Async read or write of a CHAN_FILE channel, NULL when synchronous
+    struct ring *ring;   // Shared ring of CHAN_RING channels. len and pos are its head and tail
+};
+
+// All VM state is per thread, so every host thread can run its own guest
+_Thread_local uint16_t memory[UINT16_MAX + 1];
+_Thread_local uint16_t registers[R_COUNT];
+
+_Thread_local struct symbol *symbols;
+_Thread_local size_t symbol_count;
+
+_Thread_local struct channel con_in = {.kind = CHAN_STDIO, .fd = -1};
+_Thread_local struct channel con_out = {.kind = CHAN_STDIO, .fd = -1};
+
+_Thread_local int aio_backend;
+_Thread_local struct uring ring;
+
+// Thread pool backend, shared by all VMs of the process
+pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t pool_work = PTHREAD_COND_INITIALIZER;
+pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+struct aio_req *pool_queue; // Oldest request first
+struct aio_req *pool_tail;
+
+// Idle detection state. A loop is idle when it returns to its head with the same
+// registers, without storing to memory, trapping or receiving a key in between.
+// Such a loop can only make progress once the keyboard state changes.
+_Thread_local uint16_t idle_pc;            // Loop head of the last snapshot
+_Thread_local uint16_t idle_regs[R_COUNT]; // Registers at the loop head
+_Thread_local int idle_polled;             // KBSR was read and no key was ready
+_Thread_local int idle_dirty = 1;          // Guest state changed since the snapshot
+
+// The last HISTORY_SIZE executed instructions. Always recorded, so a guest that
+// crashes or gets killed can be inspected without rerunning it under --trace. Only
+// block entries (the start, taken branches, jumps and calls) are stored, so the cost
+// is per block and not per instruction. The straight-line instructions in between
+// are rebuilt from memory by history_next
+enum
+{
+    HISTORY_SIZE = 256 // Power of two, blocks kept. Each holds at least one instruction
+};
+
+struct history_block
+{
+    uint64_t instret; // Instructions executed before the block
+    uint16_t pc;
+    uint16_t cond; // Condition flags on entry
+};
+
+// One rebuilt instruction
+struct history_entry
+{
+    uint16_t pc;
+    uint16_t instruction;
+    uint16_t cond; // Condition flags before the instruction ran, 0 when not recorded
+};
+
+_Thread_local struct history_block history[HISTORY_SIZE];
+_Thread_local uint64_t history_blocks; // Blocks entered so far
+_Thread_local uint64_t instret;                   // Instructions executed so far
+_Thread_local uint64_t trap_count;                // TRAPs executed so far
+_Thread_local uint64_t jobs_completed;            // Guests vm_run finished
+_Thread_local uint64_t instr_budget = UINT64_MAX; // See --budget
+_Thread_local int stop_reports = 1;               // Explain illegal opcodes and exhausted budgets on stderr
+
+// How vm_run stopped, also the exit status of lc3. 2 is taken by usage errors
+enum
+{
+    VM_HALTED = 0,
+    VM_ILLEGAL = 3,
+    VM_BUDGET = 4,
+};
+
+#ifdef LC3_INSTRUMENT
+// Guest accesses to one page of memory, see --heatmap
+struct heat_page
+{
+    uint64_t fetches;
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t smc_writes; // Writes to words that were executed before
+};
+
+// Bits of heat_words
+enum
+{
+    HEAT_FETCHED = 1 << 0,
+    HEAT_WRITTEN = 1 << 1,
+};
+
+_Thread_local struct heat_page *heat_pages;
+_Thread_local uint8_t *heat_words;
+#endif
+
+int uring_init(void)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    int fd = syscall(__NR_io_uring_setup, AIO_RING_SIZE, &p);
+    if (fd < 0)
+        return 0;
+
+    // IORING_OP_READ/WRITE at the current file position need 5.6, which brought this flag
+    if (!(p.features & IORING_FEAT_RW_CUR_POS))
+    {
+        close(fd);
+        return 0;
+    }
+
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    size_t sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    uint8_t *sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    uint8_t *cq = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    void *sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED)
+    {
+        if (sq != MAP_FAILED)
+            munmap(sq, sq_size);
+        if (cq != MAP_FAILED)
+            munmap(cq, cq_size);
+        if (sqes != MAP_FAILED)
+            munmap(sqes, sqes_size);
+        close(fd);
+        return 0;
+    }
+
+    ring.fd = fd;
+    ring.sq_map = sq;
+    ring.cq_map = cq;
+    ring.sqes_map = sqes;
+    ring.sq_size = sq_size;
+    ring.cq_size = cq_size;
+    ring.sqes_size = sqes_size;
+    ring.sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring.sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring.sq_array = (unsigned *)(sq + p.sq_off.array);
+    ring.sqes = sqes;
+    ring.cq_head = (unsigned *)(cq + p.cq_off.head);
+    ring.cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ring.cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 1;
+}
+
+// Unmap and close this thread's ring, once nothing is in flight
+void uring_exit(void)
+{
+    munmap(ring.sq_map, ring.sq_size);
+    munmap(ring.cq_map, ring.cq_size);
+    munmap(ring.sqes_map, ring.sqes_size);
+    close(ring.fd);
+    memset(&ring, 0, sizeof(ring));
+}
+
+// The next free submission queue entry, zeroed
+struct io_uring_sqe *uring_sqe(void)
+{
+    struct io_uring_sqe *sqe = &ring.sqes[*ring.sq_tail & *ring.sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+// Submit the entry from uring_sqe(). 0, or -errno when the kernel took nothing, in
+// which case the entry is dropped again
+int uring_push(void)
+{
+    unsigned tail = *ring.sq_tail;
+    unsigned idx = tail & *ring.sq_mask;
+    ring.sq_array[idx] = idx;
+    __atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    int n;
+    do
+        n = syscall(__NR_io_uring_enter, ring.fd, 1, 0, 0, NULL, 0);
+    while (n < 0 && (errno == EINTR || errno == EAGAIN));
+    if (n >= 1)
+        return 0;
+
+    int err = n < 0 ? -errno : -EIO;
+    __atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+    return err;
+}
+
+void uring_submit(struct aio_req *req)
+{
+    struct io_uring_sqe *sqe = uring_sqe();
+    sqe->opcode = req->write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = req->fd;
+    sqe->addr = (uintptr_t)req->buf;
+    sqe->len = req->len;
+    sqe->off = (uint64_t)-1; // Current file position, pipes ignore it
+    sqe->user_data = (uintptr_t)req;
+
+    // A refused submission completes at once with the error
+    int err = uring_push();
+    if (err)
+    {
+        req->res = err;
+        req->busy = 0;
+    }
+}
+
+// Ask the kernel to cancel req. Its completion still arrives through the ring
+void uring_cancel(struct aio_req *req)
+{
+    struct io_uring_sqe *sqe = uring_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = (uintptr_t)req;
+    sqe->user_data = 0; // Its own completion is skipped by uring_reap
+    uring_push();
+}
+
+// Mark every request in the completion queue as done
+void uring_reap(void)
+{
+    unsigned head = *ring.cq_head;
+    while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE))
+    {
+        struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+        struct aio_req *req = (struct aio_req *)(uintptr_t)cqe->user_data;
+        if (req)
+        {
+            req->res = cqe->res;
+            req->busy = 0;
+        }
+        head++;
+    }
+    __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+}
+
+// Append to the pool queue, with pool_lock held. First in, first out, so a VM that
+// keeps submitting cannot starve an older request
+void pool_enqueue(struct aio_req *req)
+{
+    req->next = NULL;
+    if (pool_tail)
+        pool_tail->next = req;
+    else
+        pool_queue = req;
+    pool_tail = req;
+}
+
+void *pool_worker(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&pool_lock);
+    for (;;)
+    {
+        while (!pool_queue)
+            pthread_cond_wait(&pool_work, &pool_lock);
+
+        struct aio_req *req = pool_queue;
+        pool_queue = req->next;
+        if (!pool_queue)
+            pool_tail = NULL;
+        pthread_mutex_unlock(&pool_lock);
+
+        // A read of an idle pipe or a write to a full one could park the worker for good,
+        // and with it every other VM's I/O. Wait a slice, then go to the back of the queue
+        struct pollfd pfd = {.fd = req->fd, .events = req->write ? POLLOUT : POLLIN};
+        ssize_t res;
+        if (poll(&pfd, 1, AIO_POLL_MS) == 0)
+        {
+            pthread_mutex_lock(&pool_lock);
+            if (!req->cancel)
+            {
+                pool_enqueue(req);
+                continue;
+            }
+            res = -ECANCELED;
+        }
+        else
+        {
+            do
+                res = req->write ? write(req->fd, req->buf, req->len) : read(req->fd, req->buf, req->len);
+            while (res < 0 && errno == EINTR);
+            pthread_mutex_lock(&pool_lock);
+        }
+
+        req->res = res;
+        __atomic_store_n(&req->busy, 0, __ATOMIC_RELEASE);
+        pthread_cond_broadcast(&pool_done);
+    }
+    return NULL;
+}
+
+void pool_start(void)
+{
+    // Workers never take signals meant for the VM threads
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+
+    for (int i = 0; i < AIO_POOL_SIZE; i++)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, pool_worker, NULL) == 0)
+            pthread_detach(thread);
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+void aio_submit(struct aio_req *req, int fd, int write, uint8_t *buf, size_t len)
+{
+    req->fd = fd;
+    req->write = write;
+    req->buf = buf;
+    req->len = len;
+    req->busy = 1;
+    req->cancel = 0;
+
+    if (aio_backend == AIO_URING)
+    {
+        uring_submit(req);
+    }
+    else
+    {
+        pthread_mutex_lock(&pool_lock);
+        pool_enqueue(req);
+        pthread_cond_signal(&pool_work);
+        pthread_mutex_unlock(&pool_lock);
+    }
+}
+
+// Request completed. Never blocks
+int aio_done(struct aio_req *req)
+{
+    if (aio_backend == AIO_URING && req->busy)
+        uring_reap();
+    return !__atomic_load_n(&req->busy, __ATOMIC_ACQUIRE);
+}
+
+void aio_wait(struct aio_req *req)
+{
+    if (aio_backend == AIO_URING)
+    {
+        while (!aio_done(req))
+            syscall(__NR_io_uring_enter, ring.fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+    }
+    else
+    {
+        pthread_mutex_lock(&pool_lock);
+        while (req->busy)
+            pthread_cond_wait(&pool_done, &pool_lock);
+        pthread_mutex_unlock(&pool_lock);
+    }
+}
+
+// Make sure req is no longer in flight, so its buffer can be freed and its fd closed.
+// Writes are waited for, reads of a pipe nobody writes to are cancelled
+void aio_cancel(struct aio_req *req)
+{
+    if (aio_done(req))
+        return;
+
+    if (aio_backend == AIO_URING)
+    {
+        if (!req->write)
+            uring_cancel(req);
+        aio_wait(req);
+        return;
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    if (!req->write)
+    {
+        req->cancel = 1;
+
+        // Still queued: take it out, no worker will see it
+        for (struct aio_req **p = &pool_queue, *prev = NULL; *p; prev = *p, p = &(*p)->next)
+        {
+            if (*p == req)
+            {
+                *p = req->next;
+                if (pool_tail == req)
+                    pool_tail = prev;
+                req->res = -ECANCELED;
+                __atomic_store_n(&req->busy, 0, __ATOMIC_RELEASE);
+                break;
+            }
+        }
+    }
+    while (req->busy)
+        pthread_cond_wait(&pool_done, &pool_lock);
+    pthread_mutex_unlock(&pool_lock);
+}
+
+// No write of the channel is in flight. Short writes are resubmitted here
+int channel_write_idle(struct channel *ch)
+{
+    struct aio_req *req = ch->req;
+    if (!aio_done(req))
+        return 0;
+
+    if (req->write && req->res > 0 && (size_t)req->res < req->len)
+    {
+        aio_submit(req, ch->fd, 1, req->buf + req->res, req->len - req->res);
+        return 0;
+    }
+    return 1;
+}
+
+// Hand the buffered output to the backend and continue in the spare buffer
+void channel_submit(struct channel *ch)
+{
+    while (!channel_write_idle(ch))
+        aio_wait(ch->req);
+
+    uint8_t *buf = ch->buf;
+    aio_submit(ch->req, ch->fd, 1, buf, ch->len);
+    ch->buf = ch->spare;
+    ch->spare = buf;
+    ch->len = 0;
+}
+
+// Switch a file channel to the async backend. Input channels start reading ahead
+void channel_async(struct channel *ch, int write)
+{
+    if (ch->kind != CHAN_FILE || ch->req)
+        return;
+
+    ch->req = calloc(1, sizeof(*ch->req));
+    ch->spare = malloc(ch->cap);
+    if (!write)
+        aio_submit(ch->req, ch->fd, 0, ch->spare, ch->cap);
+}
+
+void channel_free(struct channel *ch)
+{
+    if (ch->cap)
+        free(ch->buf);
+
+    if (ch->req)
+    {
+        // A read may still wait on a pipe. It must be gone before the fd is closed and
+        // could be reused, or it would read someone else's data into a freed buffer
+        aio_cancel(ch->req);
+        free(ch->req);
+        free(ch->spare);
+    }
+
+    if (ch->kind == CHAN_FILE && ch->fd > STDERR_FILENO)
+        close(ch->fd);
+    if (ch->ring)
+        ring_close(ch->ring);
+
+    *ch = (struct channel){.kind = CHAN_STDIO, .fd = -1};
+}
+
+void channel_attach(struct channel *ch, int fd)
+{
+    channel_free(ch);
+    ch->kind = CHAN_FILE;
+    ch->fd = fd;
+    ch->buf = malloc(CHAN_BUF_SIZE);
+    ch->cap = CHAN_BUF_SIZE;
+}
+
+int channel_open(struct channel *ch, const char *path, int flags)
+{
+    int fd = open(path, flags, 0644);
+    if (fd < 0)
+        return 0;
+
+    channel_attach(ch, fd);
+    return 1;
+}
+
+void write_all(int fd, const uint8_t *buf, size_t len)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t n = write(fd, buf + done, len - done);
+        if (n <= 0)
+            break;
+        done += n;
+    }
+}
+
+// Write out everything buffered in a file channel
+void channel_drain(struct channel *ch)
+{
+    if (ch->req)
+    {
+        if (ch->len)
+            channel_submit(ch);
+        while (!channel_write_idle(ch))
+            aio_wait(ch->req);
+        return;
+    }
+
+    write_all(ch->fd, ch->buf, ch->len);
+    ch->len = 0;
+}
+
+// channel_drain for signal handlers: write() and atomics only, never pool_lock. An
+// async write in flight completes first, its unwritten tail is written here
+void channel_drain_signal(struct channel *ch)
+{
+    if (ch->kind != CHAN_FILE)
+        return;
+
+    struct aio_req *req = ch->req;
+    if (req && req->write)
+    {
+        while (!aio_done(req))
+        {
+            if (aio_backend == AIO_URING)
+                syscall(__NR_io_uring_enter, ring.fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+            else
+                sched_yield();
+        }
+        if (req->res > 0 && (size_t)req->res < req->len)
+            write_all(ch->fd, req->buf + req->res, req->len - req->res);
+    }
+
+    write_all(ch->fd, ch->buf, ch->len);
+    ch->len = 0;
+}
+
+// Read guest input from a caller owned buffer. The buffer must outlive the run
+void console_input_buffer(const uint8_t *data, size_t len)
+{
+    channel_free(&con_in);
+    con_in.kind = CHAN_MEMORY;
+    con_in.buf = (uint8_t *)data;
+    con_in.len = len;
+}
+
+// Collect guest output in memory, see console_output()
+void console_output_buffer(void)
+{
+    channel_free(&con_out);
+    con_out.kind = CHAN_MEMORY;
+}
+
+// Serve stdin from the channel buffer when it is a file or a pipe, so input is read
+// in large chunks. Terminals stay on stdio, see disable_input_buffering()
+void console_input_stdin(void)
+{
+    if (!isatty(STDIN_FILENO))
+        channel_attach(&con_in, STDIN_FILENO);
+}
+
+// Same for stdout. Output is then written when the buffer fills up or the VM exits.
+// With console_async() also in AIO_BATCH_SIZE chunks and before the VM waits, see con_sync()
+void console_output_stdout(void)
+{
+    if (!isatty(STDOUT_FILENO))
+        channel_attach(&con_out, STDOUT_FILENO);
+}
+
+int console_input_file(const char *path)
+{
+    return channel_open(&con_in, path, O_RDONLY);
+}
+
+int console_output_file(const char *path)
+{
+    return channel_open(&con_out, path, O_WRONLY | O_CREAT | O_TRUNC);
+}
+
+// Expose guest output as the shared memory ring NAME, size bytes long (a power of two).
+// A full ring drops output instead of stalling the guest, see ring.h for the layout
+int console_output_ring(const char *name, uint32_t size)
+{
+    struct ring *r = ring_open(name, size);
+    if (!r)
+        return 0;
+
+    channel_free(&con_out);
+    con_out.kind = CHAN_RING;
+    con_out.ring = r;
+    return 1;
+}
+
+// Read guest input from the shared memory ring NAME, filled by another process
+int console_input_ring(const char *name, uint32_t size)
+{
+    struct ring *r = ring_open(name, size);
+    if (!r)
+        return 0;
+
+    channel_free(&con_in);
+    con_in.kind = CHAN_RING;
+    con_in.ring = r;
+    return 1;
+}
+
+// Move the file channels of this VM to asynchronous I/O: io_uring when the kernel
+// has it, a thread pool otherwise. Returns the backend in use
+int console_async(void)
+{
+    if (aio_backend == AIO_NONE)
+    {
+        if (uring_init())
+        {
+            aio_backend = AIO_URING;
+        }
+        else
+        {
+            aio_backend = AIO_THREADS;
+            pthread_once(&pool_once, pool_start);
+        }
+    }
+
+    channel_async(&con_in, 0);
+    channel_async(&con_out, 1);
+    return aio_backend;
+}
+
+// Output collected by a memory channel. Valid until the next console call
+const uint8_t *console_output(size_t *len)
+{
+    *len = con_out.len;
+    return con_out.buf;
+}
+
+// Flush pending output and return both channels to stdio
+void console_close(void)
+{
+    if (con_out.kind == CHAN_FILE)
+        channel_drain(&con_out);
+    else if (con_out.kind == CHAN_RING)
+        ring_finish(con_out.ring, con_out.len);
+    else if (con_out.kind == CHAN_STDIO)
+        fflush(stdout);
+
+    channel_free(&con_in);
+    channel_free(&con_out);
+
+    // The channels are synchronous again, the ring of this thread can go
+    if (aio_backend == AIO_URING)
+    {
+        uring_exit();
+        aio_backend = AIO_NONE;
+    }
+}
+
+void con_sync(void);
+
+// Input ring has data or was closed by the producer
+int ring_ready(void)
+{
+    struct ring *r = con_in.ring;
+    if ((uint32_t)con_in.pos != (uint32_t)con_in.len)
+        return 1;
+
+    int closed = __atomic_load_n(&r->closed, __ATOMIC_ACQUIRE);
+    con_in.len = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    return closed || (uint32_t)con_in.pos != (uint32_t)con_in.len;
+}
+
+void ring_block(void)
+{
+    while (!ring_ready())
+    {
+        con_sync();
+        ring_wait(con_in.ring, con_in.pos);
+    }
+}
+
+int ring_getc(void)
+{
+    struct ring *r = con_in.ring;
+    ring_block();
+    if ((uint32_t)con_in.pos == (uint32_t)con_in.len)
+        return EOF;
+
+    uint8_t c = r->data[con_in.pos & (r->size - 1)];
+    con_in.pos = (uint32_t)(con_in.pos + 1);
+    __atomic_store_n(&r->tail, (uint32_t)con_in.pos, __ATOMIC_RELEASE);
+    return c;
+}
+
+void ring_putc(int c)
+{
+    struct ring *r = con_out.ring;
+    uint32_t head = con_out.len;
+
+    if (head - (uint32_t)con_out.pos == r->size)
+    {
+        // Full as far as we know. Publish what we have and look at the consumer again
+        ring_publish(r, head);
+        con_out.pos = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        if (head - (uint32_t)con_out.pos == r->size)
+        {
+            __atomic_store_n(&r->dropped, r->dropped + 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+
+    r->data[head & (r->size - 1)] = (uint8_t)c;
+    con_out.len = head + 1;
+}
+
+int con_getc(void)
+{
+    if (con_in.kind == CHAN_STDIO)
+    {
+        con_sync();
+        return getchar();
+    }
+    if (con_in.kind == CHAN_RING)
+        return ring_getc();
+
+    if (con_in.pos == con_in.len)
+    {
+        if (con_in.kind == CHAN_MEMORY)
+            return EOF;
+
+        if (con_in.req)
+        {
+            // Take over the read ahead buffer and start filling the other one
+            if (!aio_done(con_in.req))
+            {
+                con_sync();
+                aio_wait(con_in.req);
+            }
+            if (con_in.req->res <= 0)
+                return EOF;
+
+            uint8_t *buf = con_in.buf;
+            con_in.buf = con_in.spare;
+            con_in.spare = buf;
+            con_in.len = con_in.req->res;
+            con_in.pos = 0;
+            aio_submit(con_in.req, con_in.fd, 0, con_in.spare, con_in.cap);
+            return con_in.buf[con_in.pos++];
+        }
+
+        // Refill the buffer from the file
+        con_sync();
+        ssize_t n = read(con_in.fd, con_in.buf, con_in.cap);
+        if (n <= 0)
+            return EOF;
+        con_in.len = n;
+        con_in.pos = 0;
+    }
+    return con_in.buf[con_in.pos++];
+}
+
+void con_putc(int c)
+{
+    if (con_out.kind == CHAN_STDIO)
+    {
+        putc(c, stdout);
+        return;
+    }
+    if (con_out.kind == CHAN_RING)
+    {
+        ring_putc(c);
+        return;
+    }
+
+    if (con_out.len == con_out.cap)
+    {
+        if (con_out.req)
+        {
+            channel_submit(&con_out);
+        }
+        else if (con_out.kind == CHAN_FILE)
+        {
+            channel_drain(&con_out);
+        }
+        else
+        {
+            // Grow the memory buffer
+            con_out.cap = con_out.cap ? con_out.cap * 2 : 256;
+            con_out.buf = realloc(con_out.buf, con_out.cap);
+        }
+    }
+    con_out.buf[con_out.len++] = (uint8_t)c;
+}
+
+void con_puts(const char *s)
+{
+    while (*s)
+        con_putc(*s++);
+}
+
+// Called at the end of every output trap. Only the interactive console flushes. Async
+// channels submit once AIO_BATCH_SIZE bytes are buffered and no write is in flight, so
+// small writes do not cost a submission each
+void con_flush(void)
+{
+    if (con_out.kind == CHAN_STDIO)
+        fflush(stdout);
+    else if (con_out.kind == CHAN_RING)
+        ring_publish(con_out.ring, con_out.len);
+    else if (con_out.req && con_out.len >= AIO_BATCH_SIZE && channel_write_idle(&con_out))
+        channel_submit(&con_out);
+}
+
+// Called where the VM may block or stops: reading input, waiting while idle and at
+// HALT. Writes out or hands over all buffered output, whoever feeds the input may wait on it
+void con_sync(void)
+{
+    if (con_out.req)
+    {
+        if (con_out.len)
+            channel_submit(&con_out);
+    }
+    else if (con_out.kind == CHAN_FILE)
+    {
+        channel_drain(&con_out);
+    }
+    else
+    {
+        con_flush();
+    }
+}
+
+// Input is ready without blocking. End of input counts as ready, reads return EOF
+int con_ready(void)
+{
+    if (con_in.kind == CHAN_RING)
+        return ring_ready();
+    if (con_in.kind == CHAN_MEMORY || con_in.pos < con_in.len)
+        return 1;
+    if (con_in.req)
+        return aio_done(con_in.req);
+
+    struct pollfd pfd = {.fd = con_in.kind == CHAN_FILE ? con_in.fd : STDIN_FILENO, .events = POLLIN};
+    return poll(&pfd, 1, 0) > 0;
+}
+
+// Block until input is ready
+void con_wait(void)
+{
+    if (con_ready())
+        return;
+
+    con_sync();
+    if (con_in.kind == CHAN_RING)
+    {
+        ring_block();
+        return;
+    }
+
+    if (con_in.req)
+    {
+        aio_wait(con_in.req);
+        return;
+    }
+
+    struct pollfd pfd = {.fd = con_in.kind == CHAN_FILE ? con_in.fd : STDIN_FILENO, .events = POLLIN};
+    poll(&pfd, 1, -1);
+}
+
+#ifdef LC3_INSTRUMENT
+void heat_write(uint16_t addr)
+{
+    struct heat_page *page = &heat_pages[addr >> HEAT_PAGE_SHIFT];
+    page->writes++;
+    page->smc_writes += heat_words[addr] & HEAT_FETCHED;
+    heat_words[addr] |= HEAT_WRITTEN;
+}
+
+void heat_read(uint16_t addr)
+{
+    heat_pages[addr >> HEAT_PAGE_SHIFT].reads++;
+}
+
+void heat_fetch(uint16_t addr)
+{
+    heat_pages[addr >> HEAT_PAGE_SHIFT].fetches++;
+    heat_words[addr] |= HEAT_FETCHED;
+}
+#endif
 
 void mem_write(uint16_t addr, uint16_t val)
 {
-    memory[addr] = val;
+    INSTRUMENT(if (heat_pages) heat_write(addr));
+    idle_dirty = 1;
+    memory[addr] = val;
+}
+
+// Read memory as seen by instruction fetches and loads, including the device registers
+uint16_t mem_access(uint16_t addr)
+{
+    if (addr == MR_KBSR)
+    {
+        if (con_ready())
+        {
+            memory[MR_KBSR] = (1 << 15);
+            memory[MR_KBDR] = (uint16_t)con_getc();
+            idle_dirty = 1;
+        }
+        else
+        {
+            memory[MR_KBSR] = 0;
+            idle_polled = 1;
+        }
+    }
+    return memory[addr];
+}
+
+uint16_t mem_read(uint16_t addr)
+{
+    INSTRUMENT(if (heat_pages) heat_read(addr));
+    return mem_access(addr);
+}
+
+// A read counted like mem_read's that leaves the device registers alone, for the
+// strings of PUTS and PUTSP
+uint16_t mem_peek(uint16_t addr)
+{
+    INSTRUMENT(if (heat_pages) heat_read(addr));
+    return memory[addr];
+}
+
+uint16_t mem_fetch(uint16_t addr)
+{
+    INSTRUMENT(if (heat_pages) heat_fetch(addr));
+    return mem_access(addr);
+}
+
+uint16_t sign_extend(uint16_t x, int bit_count)
+{
+    // If the most significant bit is 1 (x is negative number)
+    if ((x >> (bit_count - 1)) & 1)
+    {
+        // Shift all 1 bits over by x's bit count and fill in the space with x's data
+        x |= (0xFFFF << bit_count);
+    }
+    return x;
+}
+
+void update_condition(uint16_t r)
+{
+    if (registers[r] == 0)
+        registers[R_COND] = FL_ZRO;
+    else if (registers[r] >> 15) // If left most bit is 1, the number is negative
+        registers[R_COND] = FL_NEG;
+    else
+        registers[R_COND] = FL_POS;
+}
+
+uint16_t swap16(uint16_t x)
+{
+    return (x << 8) | (x >> 8);
+}
+
+struct termios original_tio;
+int tty_raw; // The terminal is in raw mode and original_tio must be restored
+
+// Put the terminal in raw mode so keys reach the guest one at a time and unechoed.
+// stdin is unbuffered so KBSR polling sees every key the terminal delivered
+void disable_input_buffering(void)
+{
+    tcgetattr(STDIN_FILENO, &original_tio);
+    struct termios new_tio = original_tio;
+    new_tio.c_lflag &= ~ICANON & ~ECHO;
+    tcsetattr(STDIN_FILENO, TCSANOW, &new_tio);
+    setvbuf(stdin, NULL, _IONBF, 0);
+    tty_raw = 1;
+}
+
+void restore_input_buffering(void)
+{
+    tcsetattr(STDIN_FILENO, TCSANOW, &original_tio);
+}
+
+char stats_segment[STATS_PATH_MAX]; // The --stats-shm path, empty without one
+
+// Remove the stats segment from a signal handler that ends the process, atexit
+// handlers never run there. shm_unlink is async-signal-safe and the path is ready
+void stats_unlink_signal(void)
+{
+    if (stats_segment[0])
+        shm_unlink(stats_segment);
+}
+
+// Ctrl-C in a terminal. Only async-signal-safe calls, like handle_dump_signal: the
+// interrupted code may hold the stdio locks, so nothing goes through stdio or atexit
+void handle_interrupt(int signal)
+{
+    (void)signal;
+    restore_input_buffering();
+    channel_drain_signal(&con_out);
+    stats_unlink_signal();
+    ssize_t n = write(STDOUT_FILENO, "\n", 1);
+    (void)n; // Nothing left to do about a failed write
+    _exit(-2);
+}
+
+// Walks the last HISTORY_SIZE instructions, oldest first
+struct history_cursor
+{
+    uint64_t block; // Block of the next instruction
+    uint64_t next;  // Its instret
+};
+
+struct history_cursor history_start(void)
+{
+    uint64_t oldest = history_blocks < HISTORY_SIZE ? 0 : history_blocks - HISTORY_SIZE;
+    uint64_t first = instret < HISTORY_SIZE ? 0 : instret - HISTORY_SIZE;
+    if (history_blocks == 0)
+        return (struct history_cursor){0, instret};
+
+    // The newest block starting at or before first, or the oldest one kept
+    uint64_t block = history_blocks - 1;
+    while (block > oldest && history[block & (HISTORY_SIZE - 1)].instret > first)
+        block--;
+    uint64_t start = history[block & (HISTORY_SIZE - 1)].instret;
+    return (struct history_cursor){block, start > first ? start : first};
+}
+
+// Next instruction of the walk, 0 at the end. Instruction words are read from memory
+// now, code the guest rewrote since shows its new words
+int history_next(struct history_cursor *c, struct history_entry *e)
+{
+    if (c->next >= instret)
+        return 0;
+
+    while (c->block + 1 < history_blocks && history[(c->block + 1) & (HISTORY_SIZE - 1)].instret <= c->next)
+        c->block++;
+
+    struct history_block *b = &history[c->block & (HISTORY_SIZE - 1)];
+    e->pc = b->pc + (uint16_t)(c->next - b->instret);
+    e->instruction = memory[e->pc];
+    e->cond = c->next == b->instret ? b->cond : 0;
+    c->next++;
+    return 1;
+}
+
+// Record a block entry at pc, run by vm_run
+void history_enter(uint16_t pc)
+{
+    struct history_block *b = &history[history_blocks++ & (HISTORY_SIZE - 1)];
+    b->instret = instret;
+    b->pc = pc;
+    b->cond = registers[R_COND];
+}
+
+// Append v in hex as "x3000" without stdio, for signal handlers
+char *history_hex(char *p, uint16_t v)
+{
+    *p++ = 'x';
+    for (int shift = 12; shift >= 0; shift -= 4)
+        *p++ = "0123456789ABCDEF"[(v >> shift) & 0xF];
+    return p;
+}
+
+char *history_str(char *p, const char *s)
+{
+    while (*s)
+        *p++ = *s++;
+    return p;
+}
+
+// Print the history oldest first, as "x3000  x2C0F  nZp  LD R6, x3010". COND is
+// only recorded on block entry and shows as --- elsewhere. Signal handlers pass in_signal, which leaves out the disassembly to avoid snprintf
+void history_dump(const char *reason, int in_signal)
+{
+    char line[128];
+    char *p = history_str(line, "\n-- lc3 history: ");
+    p = history_str(p, reason);
+    p = history_str(p, ", oldest first --\n");
+    if (write(STDERR_FILENO, line, p - line) < 0)
+        return;
+
+    struct history_cursor c = history_start();
+    struct history_entry e;
+    while (history_next(&c, &e))
+    {
+        p = history_hex(line, e.pc);
+        p = history_str(p, "  ");
+        p = history_hex(p, e.instruction);
+        p = history_str(p, "  ");
+        if (e.cond)
+        {
+            *p++ = e.cond & FL_NEG ? 'N' : 'n';
+            *p++ = e.cond & FL_ZRO ? 'Z' : 'z';
+            *p++ = e.cond & FL_POS ? 'P' : 'p';
+        }
+        else
+        {
+            p = history_str(p, "---");
+        }
+        if (!in_signal)
+        {
+            p = history_str(p, "  ");
+            disassemble(e.pc, e.instruction, p, line + sizeof(line) - p - 1);
+            p += strlen(p);
+        }
+        *p++ = '\n';
+        if (write(STDERR_FILENO, line, p - line) < 0)
+            return;
+    }
+}
+
+// SIGQUIT (Ctrl-\ in a terminal) and SIGTERM write out buffered guest output and print
+// the history, then die as usual
+void handle_dump_signal(int signal)
+{
+    channel_drain_signal(&con_out);
+    history_dump(signal == SIGQUIT ? "SIGQUIT" : "SIGTERM", 1);
+    if (tty_raw)
+        restore_input_buffering();
+    stats_unlink_signal();
+
+    struct sigaction sa = {.sa_handler = SIG_DFL};
+    sigaction(signal, &sa, NULL);
+    raise(signal);
+}
+
+void idle_wait(void)
+{
+    if (idle_polled)
+    {
+        // Sleep until a key arrives. Signals wake us too, the loop simply parks again
+        con_wait();
+    }
+    else if (instr_budget == UINT64_MAX)
+    {
+        // Nothing the guest reads can ever change, so it is stuck for good. With a
+        // budget it spins until the budget runs out instead
+        con_sync();
+        pause();
+    }
+}
+
+void idle_check(uint16_t target)
+{
+    if (target == idle_pc && !idle_dirty && memcmp(idle_regs, registers, sizeof(registers)) == 0)
+        idle_wait();
+
+    // Start a new iteration from the loop head
+    idle_pc = target;
+    memcpy(idle_regs, registers, sizeof(registers));
+    idle_dirty = 0;
+    idle_polled = 0;
+}
+
+void read_image_file(FILE *file)
+{
+    LC3_PROBE0(image__load__start);
+
+    // Memory origin where image should be placed
+    uint16_t origin;
+
+    // Read 16 bits into 'origin' from 'file'
+    fread(&origin, sizeof(origin), 1, file);
+
+    // Swap endianness
+    origin = swap16(origin);
+
+    // Max memory to read
+    uint16_t max_read = UINT16_MAX - origin;
+
+    // Point to origin
+    uint16_t *p = memory + origin;
+
+    // Set stream file into *p
+    size_t read = fread(p, sizeof(uint16_t), max_read, file);
+
+    while (read-- > 0)
+    {
+        *p = swap16(*p);
+        ++p;
+    }
+    LC3_PROBE2(image__load__end, origin, p - (memory + origin));
+}
+
+// Load the symbol table lc3as writes next to an image, prog.obj -> prog.sym.
+// Symbol lines look like "//	LOOP              3004"
+void read_symbols(const char *image_path)
+{
+    const char *dot = strrchr(image_path, '.');
+    const char *slash = strrchr(image_path, '/');
+    int stem = (dot && (!slash || dot > slash)) ? (int)(dot - image_path) : (int)strlen(image_path);
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%.*s.sym", stem, image_path);
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return;
+
+    char line[256];
+    char name[128];
+    unsigned addr;
+    while (fgets(line, sizeof(line), file))
+    {
+        // Header lines fail to parse an address and are skipped
+        if (sscanf(line, "//%*[ \t]%127s %x", name, &addr) != 2 || addr > UINT16_MAX)
+            continue;
+
+        symbols = realloc(symbols, (symbol_count + 1) * sizeof(*symbols));
+        symbols[symbol_count].addr = addr;
+        symbols[symbol_count].name = strdup(name);
+        symbol_count++;
+    }
+    fclose(file);
+}
+
+// Name addr after the closest symbol at or below it, "LOOP" or "LOOP+2". Empty without one
+void symbolize(uint16_t addr, char *buf, size_t size)
+{
+    struct symbol *best = NULL;
+    for (size_t i = 0; i < symbol_count; i++)
+    {
+        if (symbols[i].addr <= addr && (!best || symbols[i].addr > best->addr))
+            best = &symbols[i];
+    }
+
+    if (!best)
+        snprintf(buf, size, "%s", "");
+    else if (best->addr == addr)
+        snprintf(buf, size, "%s", best->name);
+    else
+        snprintf(buf, size, "%s+%d", best->name, addr - best->addr);
+}
+
+// Assemble source into memory at its .ORIG. Its labels become symbols, as the .sym of
+// an image would. Returns 0 with the reason in program->error, free it with asm_free()
+int load_source(const char *source, size_t len, struct asm_program *program)
+{
+    if (!assemble(source, len, program))
+        return 0;
+
+    memcpy(memory + program->origin, program->words, program->count * sizeof(uint16_t));
+    for (size_t i = 0; i < program->label_count; i++)
+    {
+        symbols = realloc(symbols, (symbol_count + 1) * sizeof(*symbols));
+        symbols[symbol_count].addr = program->labels[i].addr;
+        symbols[symbol_count].name = strdup(program->labels[i].name);
+        symbol_count++;
+    }
+    return 1;
+}
+
+// Read a whole file, NULL with *len = 0 when it does not exist
+uint8_t *read_file(const char *path, size_t *len)
+{
+    *len = 0;
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return NULL;
+
+    uint8_t *data = NULL;
+    size_t cap = 0;
+    size_t n;
+    do
+    {
+        if (*len + 1 >= cap)
+        {
+            cap = cap ? cap * 2 : 4096;
+            data = realloc(data, cap);
+        }
+        n = fread(data + *len, 1, cap - *len - 1, file);
+        *len += n;
+    } while (n > 0);
+    fclose(file);
+
+    // Terminated, so text files can be parsed in place
+    data[*len] = 0;
+    return data;
+}
+
+// Assemble and load a .asm file given in place of an image
+int read_source(const char *path)
+{
+    size_t len;
+    char *source = (char *)read_file(path, &len);
+    if (!source)
+        return 0;
+
+    struct asm_program program;
+    int loaded = load_source(source, len, &program);
+    if (!loaded)
+        printf("%s: %s\n", path, program.error);
+    asm_free(&program);
+    free(source);
+    return loaded;
+}
+
+int read_image(const char *image_path)
+{
+    // Sources are assembled on the spot
+    const char *dot = strrchr(image_path, '.');
+    if (dot && strcasecmp(dot, ".asm") == 0)
+        return read_source(image_path);
+
+    FILE *file = fopen(image_path, "rb");
+    if (!file)
+        return 0;
+
+    read_image_file(file);
+    fclose(file);
+    read_symbols(image_path);
+    return 1;
+}
+
+// Entries in ranked reports
+int report_top = REPORT_TOP;
+
+// Print the hottest of the given per address counts, annotated and disassembled
+void report_hot_pcs(const char *title, const uint64_t *counts)
+{
+    uint64_t total = 0;
+    int top = report_top > 0 ? report_top : 1;
+    int *hot = malloc(top * sizeof(*hot));
+    int used = 0;
+
+    // Keep the top addresses sorted by count with an insertion sort
+    for (int addr = 0; addr <= UINT16_MAX; addr++)
+    {
+        uint64_t n = counts[addr];
+        if (!n)
+            continue;
+        total += n;
+
+        if (used == top && counts[hot[used - 1]] >= n)
+            continue;
+
+        int i = used < top ? used++ : used - 1;
+        while (i > 0 && counts[hot[i - 1]] < n)
+        {
+            hot[i] = hot[i - 1];
+            i--;
+        }
+        hot[i] = addr;
+    }
+
+    fprintf(stderr, "\n-- %s: %llu total --\n", title, (unsigned long long)total);
+    fprintf(stderr, "           count       %%   cum %%  addr   symbol                instruction\n");
+
+    uint64_t cumulative = 0;
+    for (int i = 0; i < used; i++)
+    {
+        char label[64];
+        char text[64];
+        uint16_t addr = hot[i];
+        symbolize(addr, label, sizeof(label));
+        disassemble(addr, memory[addr], text, sizeof(text));
+
+        cumulative += counts[addr];
+        fprintf(stderr, "%16llu  %6.2f  %6.2f  x%04X  %-20s  %s\n", (unsigned long long)counts[addr],
+                100.0 * counts[addr] / total, 100.0 * cumulative / total, addr, label, text);
+    }
+    free(hot);
+}
+
+// When the guest started running
+struct timespec start_time;
+
+double elapsed_since(struct timespec start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+#ifdef LC3_INSTRUMENT
+// Execution statistics, reported by --stats
+_Thread_local uint64_t stat_ops[16];
+_Thread_local uint64_t stat_variants[VAR_COUNT];
+_Thread_local uint64_t stat_traps[256];
+
+// Executions of every guest address, reported by --profile
+_Thread_local uint64_t pc_counts[UINT16_MAX + 1];
+
+void report_stats(void)
+{
+    double seconds = elapsed_since(start_time);
+
+    uint64_t total = 0;
+    for (int i = 0; i < 16; i++)
+        total += stat_ops[i];
+
+    fprintf(stderr, "\n-- lc3 stats --\n");
+    fprintf(stderr, "instructions  %llu\n", (unsigned long long)total);
+    fprintf(stderr, "wall time     %.6f s\n", seconds);
+    fprintf(stderr, "MIPS          %.2f\n", seconds > 0 ? total / seconds / 1e6 : 0.0);
+
+    fprintf(stderr, "\nopcode               count       %%\n");
+    for (int i = 0; i < 16; i++)
+    {
+        if (stat_ops[i])
+            fprintf(stderr, "%-12s %14llu  %6.2f\n", op_names[i], (unsigned long long)stat_ops[i], 100.0 * stat_ops[i] / total);
+    }
+
+    fprintf(stderr, "\nvariant              count       %%\n");
+    for (int i = 0; i < VAR_COUNT; i++)
+    {
+        if (stat_variants[i])
+            fprintf(stderr, "%-12s %14llu  %6.2f\n", variant_names[i], (unsigned long long)stat_variants[i], 100.0 * stat_variants[i] / total);
+    }
+
+    fprintf(stderr, "\ntrap                 count\n");
+    for (int i = 0; i < 256; i++)
+    {
+        if (!stat_traps[i])
+            continue;
+        if (i >= TRAP_GETC && i <= TRAP_HALT)
+            fprintf(stderr, "%-12s %14llu\n", trap_names[i - TRAP_GETC], (unsigned long long)stat_traps[i]);
+        else
+            fprintf(stderr, "x%02X          %14llu\n", i, (unsigned long long)stat_traps[i]);
+    }
+}
+
+void report_profile(void)
+{
+    report_hot_pcs("lc3 profile, executed instructions", pc_counts);
+}
+
+// Node of the guest call tree, one per distinct call path. Children are always
+// created after their parent, so they have higher indexes
+struct call_node
+{
+    uint16_t addr;    // Entry address of the subroutine, or the vector of a trap
+    uint16_t trap;    // Node is a trap
+    uint32_t parent;
+    uint32_t child;   // First child, 0 when there is none
+    uint32_t sibling; // Next child of the parent, 0 at the end
+    uint64_t self;    // Instructions executed in this path itself
+};
+
+// Call tree of --callgraph. Node 0 is the program entry
+_Thread_local struct call_node *call_nodes;
+_Thread_local uint32_t call_node_count;
+_Thread_local uint32_t call_current;
+_Thread_local uint32_t call_depth;
+_Thread_local uint32_t call_overflow; // Calls past CALL_DEPTH_MAX not given a node
+_Thread_local const char *callgraph_path;
+
+void callgraph_start(uint16_t entry)
+{
+    call_nodes = calloc(1, sizeof(*call_nodes));
+    call_nodes[0].addr = entry;
+    call_node_count = 1;
+}
+
+// Child of the current node for a call to addr
+uint32_t call_child(uint16_t addr, uint16_t trap)
+{
+    for (uint32_t i = call_nodes[call_current].child; i; i = call_nodes[i].sibling)
+    {
+        if (call_nodes[i].addr == addr && call_nodes[i].trap == trap)
+            return i;
+    }
+
+    if ((call_node_count & (call_node_count - 1)) == 0)
+        call_nodes = realloc(call_nodes, 2 * call_node_count * sizeof(*call_nodes));
+
+    uint32_t i = call_node_count++;
+    call_nodes[i] = (struct call_node){
+        .addr = addr,
+        .trap = trap,
+        .parent = call_current,
+        .sibling = call_nodes[call_current].child,
+    };
+    call_nodes[call_current].child = i;
+    return i;
+}
+
+void call_enter(uint16_t addr)
+{
+    if (call_depth == CALL_DEPTH_MAX)
+    {
+        call_overflow++;
+        return;
+    }
+    call_current = call_child(addr, 0);
+    call_depth++;
+}
+
+void call_leave(void)
+{
+    if (call_overflow)
+    {
+        call_overflow--;
+    }
+    else if (call_depth)
+    {
+        call_current = call_nodes[call_current].parent;
+        call_depth--;
+    }
+}
+
+// Charge the TRAP instruction that just executed to a leaf for its vector
+void call_trap(uint8_t vector)
+{
+    call_nodes[call_current].self--;
+    call_nodes[call_child(vector, 1)].self++;
+}
+
+void call_name(uint32_t node, char *buf, size_t size)
+{
+    struct call_node *n = &call_nodes[node];
+    if (n->trap)
+    {
+        if (n->addr >= TRAP_GETC && n->addr <= TRAP_HALT)
+            snprintf(buf, size, "TRAP_%s", trap_names[n->addr - TRAP_GETC]);
+        else
+            snprintf(buf, size, "TRAP_x%02X", n->addr);
+        return;
+    }
+
+    char label[64];
+    symbolize(n->addr, label, sizeof(label));
+    if (label[0] && !strchr(label, '+'))
+        snprintf(buf, size, "%s", label);
+    else if (node == 0)
+        snprintf(buf, size, "main");
+    else
+        snprintf(buf, size, "x%04X", n->addr);
+}
+
+// Semicolon separated names from the root down to node, as flamegraph tools expect
+void call_path(uint32_t node, char *buf, size_t size)
+{
+    char name[64];
+    call_name(node, name, sizeof(name));
+    if (node == 0)
+    {
+        snprintf(buf, size, "%s", name);
+        return;
+    }
+
+    call_path(call_nodes[node].parent, buf, size);
+    size_t used = strlen(buf);
+    snprintf(buf + used, size - used, ";%s", name);
+}
+
+// Write folded stacks to the --callgraph file and list the most expensive call paths
+void report_callgraph(void)
+{
+    static char path[CALL_DEPTH_MAX * 24];
+
+    uint64_t *inclusive = malloc(call_node_count * sizeof(*inclusive));
+    for (uint32_t i = 0; i < call_node_count; i++)
+        inclusive[i] = call_nodes[i].self;
+    for (uint32_t i = call_node_count - 1; i > 0; i--)
+        inclusive[call_nodes[i].parent] += inclusive[i];
+
+    FILE *file = fopen(callgraph_path, "w");
+    if (!file)
+    {
+        fprintf(stderr, "failed to write call graph: %s\n", callgraph_path);
+    }
+    else
+    {
+        for (uint32_t i = 0; i < call_node_count; i++)
+        {
+            if (!call_nodes[i].self)
+                continue;
+            call_path(i, path, sizeof(path));
+            fprintf(file, "%s %llu\n", path, (unsigned long long)call_nodes[i].self);
+        }
+        fclose(file);
+    }
+
+    // Rank paths by inclusive count
+    int top = report_top < (int)call_node_count ? report_top : (int)call_node_count;
+    uint32_t *hot = malloc(call_node_count * sizeof(*hot));
+    for (uint32_t i = 0; i < call_node_count; i++)
+        hot[i] = i;
+    for (int i = 0; i < top; i++)
+    {
+        for (uint32_t k = i + 1; k < call_node_count; k++)
+        {
+            if (inclusive[hot[k]] > inclusive[hot[i]])
+            {
+                uint32_t t = hot[i];
+                hot[i] = hot[k];
+                hot[k] = t;
+            }
+        }
+    }
+
+    fprintf(stderr, "\n-- lc3 call graph: %u call paths --\n", call_node_count);
+    fprintf(stderr, "       inclusive       exclusive  path\n");
+    for (int i = 0; i < top; i++)
+    {
+        call_path(hot[i], path, sizeof(path));
+        fprintf(stderr, "%16llu%16llu  %s\n", (unsigned long long)inclusive[hot[i]],
+                (unsigned long long)call_nodes[hot[i]].self, path);
+    }
+
+    free(hot);
+    free(inclusive);
+}
+
+// Outcomes of one BR instruction
+struct branch_site
+{
+    uint64_t executed;
+    uint64_t taken;
+    uint64_t flips; // Outcome differed from the previous one, a measure of predictability
+    int last;       // Previous outcome
+};
+
+// Branch sites by address, see --branches
+_Thread_local struct branch_site *branch_sites;
+_Thread_local const char *branches_path;
+
+void branch_count(uint16_t addr, int taken)
+{
+    struct branch_site *site = &branch_sites[addr];
+    taken = taken != 0;
+    site->flips += site->executed && taken != site->last;
+    site->last = taken;
+    site->taken += taken;
+    site->executed++;
+}
+
+// Write every executed branch site to the --branches file, as JSON when the name ends
+// in .json and CSV otherwise
+void report_branches(void)
+{
+    FILE *file = fopen(branches_path, "w");
+    if (!file)
+    {
+        fprintf(stderr, "failed to write branch statistics: %s\n", branches_path);
+        return;
+    }
+
+    size_t len = strlen(branches_path);
+    int json = len >= 5 && strcmp(branches_path + len - 5, ".json") == 0;
+    if (json)
+        fprintf(file, "[\n");
+    else
+        fprintf(file, "addr,symbol,instruction,target,target_symbol,executed,taken,not_taken,flips\n");
+
+    int first = 1;
+    for (int addr = 0; addr <= UINT16_MAX; addr++)
+    {
+        struct branch_site *site = &branch_sites[addr];
+        if (!site->executed)
+            continue;
+
+        char label[64];
+        char target_label[64];
+        char text[64];
+        uint16_t target = addr + 1 + sign_extend(memory[addr] & 0x1FF, 9);
+        symbolize(addr, label, sizeof(label));
+        symbolize(target, target_label, sizeof(target_label));
+        disassemble(addr, memory[addr], text, sizeof(text));
+
+        if (json)
+        {
+            fprintf(file,
+                    "%s  {\"addr\": %d, \"symbol\": \"%s\", \"instruction\": \"%s\", \"target\": %d, \"target_symbol\": \"%s\", "
+                    "\"executed\": %llu, \"taken\": %llu, \"not_taken\": %llu, \"flips\": %llu}",
+                    first ? "" : ",\n", addr, label, text, target, target_label, (unsigned long long)site->executed,
+                    (unsigned long long)site->taken, (unsigned long long)(site->executed - site->taken),
+                    (unsigned long long)site->flips);
+        }
+        else
+        {
+            fprintf(file, "x%04X,%s,%s,x%04X,%s,%llu,%llu,%llu,%llu\n", addr, label, text, target, target_label,
+                    (unsigned long long)site->executed, (unsigned long long)site->taken,
+                    (unsigned long long)(site->executed - site->taken), (unsigned long long)site->flips);
+        }
+        first = 0;
+    }
+
+    if (json)
+        fprintf(file, "\n]\n");
+    fclose(file);
+}
+
+struct trace_buf
+{
+    uint8_t data[TRACE_BUF_SIZE];
+    size_t len;
+    struct trace_buf *next;
+};
+
+// Trace writer of a VM. Full buffers go to a background thread that writes them in order
+struct tracer
+{
+    int fd;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct trace_buf *full;      // Oldest full buffer
+    struct trace_buf *full_tail; // Newest full buffer
+    struct trace_buf *free;
+    struct trace_buf *current;   // Buffer the VM writes records to
+    int closing;
+
+    // Encoder state, see trace.h
+    uint16_t last_insn[UINT16_MAX + 1];
+    uint16_t prev_pc;
+    uint16_t prev_addr;
+    uint32_t run;
+
+    // Record of the instruction executing now
+    int pending;
+    int has_mem;
+    uint16_t pc;
+    uint16_t insn;
+    uint16_t addr;
+};
+
+_Thread_local struct tracer *tracer;
+
+void *trace_writer(void *arg)
+{
+    struct tracer *t = arg;
+
+    pthread_mutex_lock(&t->lock);
+    for (;;)
+    {
+        struct trace_buf *buf = t->full;
+        if (!buf)
+        {
+            if (t->closing)
+                break;
+            pthread_cond_wait(&t->cond, &t->lock);
+            continue;
+        }
+
+        t->full = buf->next;
+        pthread_mutex_unlock(&t->lock);
+
+        size_t done = 0;
+        while (done < buf->len)
+        {
+            ssize_t n = write(t->fd, buf->data + done, buf->len - done);
+            if (n <= 0 && errno != EINTR)
+                break;
+            if (n > 0)
+                done += n;
+        }
+        buf->len = 0;
+
+        pthread_mutex_lock(&t->lock);
+        buf->next = t->free;
+        t->free = buf;
+        pthread_cond_broadcast(&t->cond);
+    }
+    pthread_mutex_unlock(&t->lock);
+    return NULL;
+}
+
+// Queue the current buffer for writing and continue in a free one
+void trace_handoff(struct tracer *t)
+{
+    pthread_mutex_lock(&t->lock);
+    t->current->next = NULL;
+    if (t->full)
+        t->full_tail->next = t->current;
+    else
+        t->full = t->current;
+    t->full_tail = t->current;
+    pthread_cond_broadcast(&t->cond);
+
+    // Only waits when the disk is TRACE_BUF_COUNT buffers behind
+    while (!t->free)
+        pthread_cond_wait(&t->cond, &t->lock);
+    t->current = t->free;
+    t->free = t->current->next;
+    pthread_mutex_unlock(&t->lock);
+}
+
+uint8_t *trace_reserve(struct tracer *t)
+{
+    if (t->current->len + TRACE_RECORD_MAX > TRACE_BUF_SIZE)
+        trace_handoff(t);
+    return t->current->data + t->current->len;
+}
+
+void trace_flush_run(struct tracer *t)
+{
+    if (!t->run)
+        return;
+
+    uint8_t *p = trace_reserve(t);
+    *p = TRACE_RUN | (t->run - 1);
+    t->current->len++;
+    t->run = 0;
+}
+
+// Encode the pending record
+void trace_emit(struct tracer *t)
+{
+    uint16_t expected = t->prev_pc + 1;
+    int jump = t->pc != expected;
+    int insn = t->last_insn[t->pc] != t->insn;
+    t->prev_pc = t->pc;
+    t->last_insn[t->pc] = t->insn;
+
+    if (!jump && !insn && !t->has_mem)
+    {
+        if (++t->run == TRACE_RUN_MAX)
+            trace_flush_run(t);
+        return;
+    }
+    trace_flush_run(t);
+
+    uint8_t *start = trace_reserve(t);
+    uint8_t *p = start;
+    *p++ = (jump ? TRACE_PC : 0) | (insn ? TRACE_INSN : 0) | (t->has_mem ? TRACE_MEM : 0);
+    if (jump)
+        p = trace_put_varint(p, trace_zigzag(t->pc - expected));
+    if (insn)
+    {
+        *p++ = t->insn & 0xFF;
+        *p++ = t->insn >> 8;
+    }
+    if (t->has_mem)
+    {
+        // Loads and stores are done by now, so memory holds the value either way
+        p = trace_put_varint(p, trace_zigzag(t->addr - t->prev_addr));
+        p = trace_put_varint(p, memory[t->addr]);
+        t->prev_addr = t->addr;
+    }
+    t->current->len += p - start;
+}
+
+void trace_begin(uint16_t pc, uint16_t insn)
+{
+    struct tracer *t = tracer;
+    if (t->pending)
+        trace_emit(t);
+
+    t->pending = 1;
+    t->has_mem = 0;
+    t->pc = pc;
+    t->insn = insn;
+}
+
+void trace_mem(uint16_t addr)
+{
+    tracer->has_mem = 1;
+    tracer->addr = addr;
+}
+
+// Start writing an execution trace of this VM to path
+int trace_open(const char *path)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return 0;
+
+    struct tracer *t = calloc(1, sizeof(*t));
+    t->fd = fd;
+    pthread_mutex_init(&t->lock, NULL);
+    pthread_cond_init(&t->cond, NULL);
+    for (int i = 0; i < TRACE_BUF_COUNT; i++)
+    {
+        struct trace_buf *buf = malloc(sizeof(*buf));
+        buf->len = 0;
+        buf->next = t->free;
+        t->free = buf;
+    }
+    t->current = t->free;
+    t->free = t->current->next;
+
+    memcpy(t->current->data, TRACE_MAGIC, 8);
+    t->current->len = 8;
+
+    // The writer never takes signals meant for the VM thread
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int started = pthread_create(&t->thread, NULL, trace_writer, t) == 0;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (!started)
+    {
+        close(fd);
+        free(t->current);
+        while (t->free)
+        {
+            struct trace_buf *next = t->free->next;
+            free(t->free);
+            t->free = next;
+        }
+        free(t);
+        return 0;
+    }
+
+    tracer = t;
+    return 1;
+}
+
+// Write out the rest of the trace and wait for the writer thread
+void trace_close(void)
+{
+    struct tracer *t = tracer;
+    if (!t)
+        return;
+    tracer = NULL;
+
+    if (t->pending)
+        trace_emit(t);
+    trace_flush_run(t);
+    trace_handoff(t);
+
+    pthread_mutex_lock(&t->lock);
+    t->closing = 1;
+    pthread_cond_broadcast(&t->cond);
+    pthread_mutex_unlock(&t->lock);
+    pthread_join(t->thread, NULL);
+
+    close(t->fd);
+    free(t->current);
+    while (t->free)
+    {
+        struct trace_buf *next = t->free->next;
+        free(t->free);
+        t->free = next;
+    }
+    free(t);
+}
+
+// Summarize guest memory use per page: working set, hottest pages, code/data overlap
+// and an overview map of all pages
+void report_heatmap(void)
+{
+    static const char shades[] = " .:-=+*#%@";
+
+    uint64_t max = 0;
+    uint64_t smc = 0;
+    int touched = 0, code = 0, data = 0, mixed = 0;
+    for (int i = 0; i < HEAT_PAGE_COUNT; i++)
+    {
+        struct heat_page *page = &heat_pages[i];
+        uint64_t total = page->fetches + page->reads + page->writes;
+        if (!total)
+            continue;
+
+        touched++;
+        code += page->fetches != 0;
+        data += page->reads || page->writes;
+        mixed += page->fetches && page->writes;
+        smc += page->smc_writes;
+        if (total > max)
+            max = total;
+    }
+
+    fprintf(stderr, "\n-- lc3 heatmap: %d word pages --\n", 1 << HEAT_PAGE_SHIFT);
+    fprintf(stderr, "pages touched          %d (%d words)\n", touched, touched << HEAT_PAGE_SHIFT);
+    fprintf(stderr, "pages with code        %d\n", code);
+    fprintf(stderr, "pages with data        %d\n", data);
+    fprintf(stderr, "code pages written     %d\n", mixed);
+    fprintf(stderr, "self-modifying writes  %llu\n", (unsigned long long)smc);
+
+    // Hottest pages by total accesses
+    int top = report_top < touched ? report_top : touched;
+    int *hot = malloc((touched ? touched : 1) * sizeof(*hot));
+    int used = 0;
+    for (int i = 0; i < HEAT_PAGE_COUNT; i++)
+    {
+        if (heat_pages[i].fetches + heat_pages[i].reads + heat_pages[i].writes)
+            hot[used++] = i;
+    }
+    for (int i = 0; i < top; i++)
+    {
+        for (int k = i + 1; k < used; k++)
+        {
+            struct heat_page *a = &heat_pages[hot[i]], *b = &heat_pages[hot[k]];
+            if (b->fetches + b->reads + b->writes > a->fetches + a->reads + a->writes)
+            {
+                int t = hot[i];
+                hot[i] = hot[k];
+                hot[k] = t;
+            }
+        }
+    }
+
+    fprintf(stderr, "\npage         symbol                     fetches           reads          writes      smc\n");
+    for (int i = 0; i < top; i++)
+    {
+        struct heat_page *page = &heat_pages[hot[i]];
+        uint16_t start = hot[i] << HEAT_PAGE_SHIFT;
+        // Label with the first symbol inside the page, a page of stack is not "MAIN+49058"
+        const char *label = "";
+        uint16_t label_addr = 0xFFFF;
+        for (size_t k = 0; k < symbol_count; k++)
+        {
+            if (symbols[k].addr >> HEAT_PAGE_SHIFT == hot[i] && symbols[k].addr <= label_addr)
+            {
+                label = symbols[k].name;
+                label_addr = symbols[k].addr;
+            }
+        }
+        fprintf(stderr, "x%04X-x%04X  %-20s %15llu %15llu %15llu %8llu\n", start,
+                (uint16_t)(start + (1 << HEAT_PAGE_SHIFT) - 1), label, (unsigned long long)page->fetches,
+                (unsigned long long)page->reads, (unsigned long long)page->writes,
+                (unsigned long long)page->smc_writes);
+    }
+    free(hot);
+
+    // One character per page, 64 pages per line, shaded on a log scale of the busiest page
+    fprintf(stderr, "\n       ");
+    for (int col = 0; col < 64; col += 8)
+        fprintf(stderr, "x%04X   ", col << HEAT_PAGE_SHIFT);
+    for (int i = 0; i < HEAT_PAGE_COUNT; i++)
+    {
+        if (i % 64 == 0)
+            fprintf(stderr, "\nx%04X  ", i << HEAT_PAGE_SHIFT);
+
+        struct heat_page *page = &heat_pages[i];
+        uint64_t total = page->fetches + page->reads + page->writes;
+        int shade = 0;
+        if (total)
+        {
+            int bits = 63 - __builtin_clzll(total);
+            int max_bits = 63 - __builtin_clzll(max);
+            shade = 1 + 8 * bits / (max_bits ? max_bits : 1);
+        }
+        fputc(shades[shade], stderr);
+    }
+    fprintf(stderr, "\n");
+}
+#endif
+
+// Statistical profiler, see --sample. vm_run stores the address of every instruction
+// to fetch_pc before fetching it, so a tick lands on the instruction that was running
+// even after a taken branch, JSR or TRAP moved the PC on. Volatile, because the handler
+// interrupts the VM thread in the middle of the loop
+_Thread_local volatile sig_atomic_t fetch_pc;
+_Thread_local uint64_t *sample_counts;
+_Thread_local timer_t sample_timer;
+
+void handle_sample(int signal)
+{
+    (void)signal;
+    uint64_t *counts = sample_counts;
+    if (counts)
+        counts[(uint16_t)fetch_pc]++;
 }
 
-uint16_t mem_read(uint16_t addr)
+// Sample the guest PC hz times per second of CPU time used by this thread
+int start_sampling(int hz)
 {
-    return memory[addr];
+    struct sigaction sa = {.sa_handler = handle_sample, .sa_flags = SA_RESTART};
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGPROF, &sa, NULL);
+
+    struct sigevent sev = {.sigev_notify = SIGEV_THREAD_ID, .sigev_signo = SIGPROF};
+    sev.sigev_notify_thread_id = syscall(SYS_gettid);
+    if (hz <= 0 || timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &sample_timer) < 0)
+        return 0;
+
+    sample_counts = calloc(UINT16_MAX + 1, sizeof(uint64_t));
+    long ns = 1000000000L / hz;
+    struct itimerspec its = {
+        .it_interval = {.tv_sec = ns / 1000000000L, .tv_nsec = ns % 1000000000L},
+        .it_value = {.tv_sec = ns / 1000000000L, .tv_nsec = ns % 1000000000L},
+    };
+    timer_settime(sample_timer, 0, &its, NULL);
+    return 1;
 }
 
-uint16_t sign_extend(uint16_t x, int bit_count)
+void report_samples(void)
 {
-    // If the most significant bit is 1 (x is negative number)
-    if ((x >> (bit_count - 1)) & 1)
-    {
-        // Shift all 1 bits over by x's bit count and fill in the space with x's data
-        x |= (0xFFFF << bit_count);
-    }
-    return x;
+    timer_delete(sample_timer);
+    report_hot_pcs("lc3 samples", sample_counts);
 }
 
-void update_condition(uint16_t r)
+// Live counters in shared memory, see --stats-shm. A timer signal on the VM thread
+// publishes them from the handler, so the execution loop checks for nothing
+enum
 {
-    if (registers[r] == 0)
-        registers[R_COND] = FL_ZRO;
-    else if (registers[r] >> 15) // If left most bit is 1, the number is negative
-        registers[R_COND] = FL_NEG;
-    else
-        registers[R_COND] = FL_POS;
+    STATS_INTERVAL_MS = 100
+};
+
+_Thread_local struct stats_shm *stats_shm;
+_Thread_local const char *stats_name;
+_Thread_local timer_t stats_timer;
+
+void stats_publish(uint32_t state)
+{
+    struct stats_shm *s = stats_shm;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    stats_write_begin(s);
+    __atomic_store_n(&s->start_ns, start_time.tv_sec * 1000000000ULL + start_time.tv_nsec, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->update_ns, now.tv_sec * 1000000000ULL + now.tv_nsec, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->instret, instret, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->traps, trap_count, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->jobs_completed, jobs_completed, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->queue_depth, 0, __ATOMIC_RELAXED); // One guest per process, nothing queues
+    __atomic_store_n(&s->pc, registers[R_PC], __ATOMIC_RELAXED);
+    __atomic_store_n(&s->state, state, __ATOMIC_RELAXED);
+    stats_write_end(s);
 }
 
-uint16_t swap16(uint16_t x)
+void handle_stats_timer(int signal)
 {
-    return (x << 8) | (x >> 8);
+    (void)signal;
+    stats_publish(STATS_RUNNING);
 }
 
-void read_image_file(FILE *file)
+int start_stats(const char *name)
 {
+    stats_shm = stats_open(name, 1);
+    if (!stats_shm)
+        return 0;
+    stats_name = name;
+    stats_path(stats_segment, name);
 
-    // Memory origin where image should be placed
-    uint16_t origin;
+    struct sigaction sa = {.sa_handler = handle_stats_timer, .sa_flags = SA_RESTART};
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGALRM, &sa, NULL);
 
-    // Read 16 bits into 'origin' from 'file'
-    fread(&origin, sizeof(origin), 1, file);
+    struct sigevent sev = {.sigev_notify = SIGEV_THREAD_ID, .sigev_signo = SIGALRM};
+    sev.sigev_notify_thread_id = syscall(SYS_gettid);
+    if (timer_create(CLOCK_MONOTONIC, &sev, &stats_timer) < 0)
+    {
+        stats_unlink(name);
+        return 0;
+    }
 
-    // Swap endianness
-    origin = swap16(origin);
+    struct itimerspec its = {
+        .it_interval = {.tv_nsec = STATS_INTERVAL_MS * 1000000L},
+        .it_value = {.tv_nsec = STATS_INTERVAL_MS * 1000000L},
+    };
+    timer_settime(stats_timer, 0, &its, NULL);
+    return 1;
+}
 
-    // Max memory to read
-    uint16_t max_read = UINT16_MAX - origin;
+// Publish the final counters. Readers that have the segment mapped still see them
+void stop_stats(void)
+{
+    timer_delete(stats_timer);
+    stats_publish(STATS_EXITED);
+    stats_unlink(stats_name);
+}
 
-    // Point to origin
-    uint16_t *p = memory + origin;
+// Host hardware counters of the VM thread while vm_run executes, see --hw-counters
+enum
+{
+    HW_CYCLES,
+    HW_INSTRUCTIONS,
+    HW_BRANCH_MISSES,
+    HW_L1D_MISSES,
+    HW_COUNT
+};
 
-    // Set stream file into *p
-    size_t read = fread(p, sizeof(uint16_t), max_read, file);
+const char *hw_names[HW_COUNT] = {"cycles", "instructions", "branch misses", "L1d read misses"};
 
-    while (read-- > 0)
+_Thread_local int hw_fds[HW_COUNT] = {-1, -1, -1, -1};
+
+// Open the counters as one group led by cycles so they all count over the same
+// time. Only the leader is required, the CPU may lack the others
+int hw_open(void)
+{
+    static const struct
     {
-        *p = swap16(*p);
-        ++p;
+        uint32_t type;
+        uint64_t config;
+    } events[HW_COUNT] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                                 PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+    };
+
+    for (int i = 0; i < HW_COUNT; i++)
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[i].type;
+        attr.config = events[i].config;
+        attr.disabled = i == HW_CYCLES; // Members follow the leader
+        attr.exclude_kernel = 1;        // Enough for perf_event_paranoid up to 2
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        hw_fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, i == HW_CYCLES ? -1 : hw_fds[HW_CYCLES], 0);
+        if (hw_fds[HW_CYCLES] < 0)
+            return 0;
     }
+    return 1;
 }
 
-void read_image(const char *image_path)
+void hw_start(void)
 {
-    FILE *file = fopen(image_path, "rb");
-    if (!file)
-        return 0;
+    if (hw_fds[HW_CYCLES] < 0)
+        return;
+    ioctl(hw_fds[HW_CYCLES], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(hw_fds[HW_CYCLES], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
 
-    read_image_file(file);
-    fclose(file);
-    return 1;
+void hw_stop(void)
+{
+    if (hw_fds[HW_CYCLES] >= 0)
+        ioctl(hw_fds[HW_CYCLES], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
 }
 
-int main(int argc, const char *argv[])
+void report_hw_counters(void)
 {
+    fprintf(stderr, "\n-- lc3 hw counters --\n");
+    fprintf(stderr, "guest instructions %15llu\n", (unsigned long long)instret);
 
-    // Check for code passed to vm
-    if (argc < 2)
+    double counts[HW_COUNT] = {0};
+    for (int i = 0; i < HW_COUNT; i++)
     {
-        printf("lc3 [image-file1] ..\n");
-        exit(2);
+        // value, time enabled, time running
+        uint64_t values[3];
+        if (hw_fds[i] < 0 || read(hw_fds[i], values, sizeof(values)) != sizeof(values))
+        {
+            fprintf(stderr, "%-18s %15s\n", hw_names[i], "not supported");
+            continue;
+        }
+        close(hw_fds[i]);
+
+        // Scale up if the kernel had to multiplex the group with other users
+        counts[i] = values[2] ? (double)values[0] * values[1] / values[2] : 0;
+        fprintf(stderr, "%-18s %15.0f  %8.3f per guest instruction\n", hw_names[i], counts[i],
+                instret ? counts[i] / instret : 0.0);
     }
 
-    // Make sure programs can be read
-    for (int j = 1; j < argc; j++)
+    if (counts[HW_CYCLES] > 0 && counts[HW_INSTRUCTIONS] > 0)
+        fprintf(stderr, "host IPC           %15.2f\n", counts[HW_INSTRUCTIONS] / counts[HW_CYCLES]);
+}
+
+// State dump on SIGUSR1. The handler only raises dump_requested, the execution loop
+// checks it at the end of every block (taken BR, JMP, JSR and TRAP) and calls dump_state
+_Thread_local volatile sig_atomic_t dump_requested;
+
+void handle_dump_request(int signal)
+{
+    (void)signal;
+    dump_requested = 1;
+}
+
+// Hot PCs among the last HISTORY_SIZE instructions, for dump_state when no profiler runs
+void history_hot_pcs(void)
+{
+    uint64_t *counts = calloc(UINT16_MAX + 1, sizeof(uint64_t));
+    struct history_cursor c = history_start();
+    struct history_entry e;
+    while (history_next(&c, &e))
+        counts[e.pc]++;
+
+    report_hot_pcs("lc3 history hot PCs, --sample profiles the whole run", counts);
+    free(counts);
+}
+
+void dump_state(void)
+{
+    dump_requested = 0;
+    double seconds = elapsed_since(start_time);
+
+    // Output so far, so the dump can be read next to it
+    con_sync();
+
+    fprintf(stderr, "\n-- lc3 state --\n");
+    for (int i = R_R0; i <= R_R7; i++)
+        fprintf(stderr, "R%d x%04X%s", i, registers[i], i == R_R7 ? "\n" : "  ");
+
+    char label[64];
+    symbolize(registers[R_PC], label, sizeof(label));
+    fprintf(stderr, "PC x%04X%s%s  COND %c%c%c\n", registers[R_PC], label[0] ? " " : "", label,
+            registers[R_COND] & FL_NEG ? 'N' : 'n',
+            registers[R_COND] & FL_ZRO ? 'Z' : 'z', registers[R_COND] & FL_POS ? 'P' : 'p');
+    fprintf(stderr, "instructions  %llu\n", (unsigned long long)instret);
+    fprintf(stderr, "traps         %llu\n", (unsigned long long)trap_count);
+    fprintf(stderr, "wall time     %.6f s\n", seconds);
+    fprintf(stderr, "MIPS          %.2f\n", seconds > 0 ? instret / seconds / 1e6 : 0.0);
+
+    // Hot PCs from whichever profiler is running, else from the history ring
+    if (sample_counts)
+        report_hot_pcs("lc3 samples so far", sample_counts);
+#ifdef LC3_INSTRUMENT
+    else
+        report_hot_pcs("lc3 profile so far", pc_counts);
+#else
+    else
+        history_hot_pcs();
+#endif
+}
+
+// Explain on stderr why vm_run stopped early, unless stop_reports is off. Out of line
+// and cold, so neither the reports nor the stop_reports load weigh on the dispatch loop
+__attribute__((cold, noinline)) void report_stop(int status, uint16_t instruction)
+{
+    if (!stop_reports)
+        return;
+
+    if (status == VM_BUDGET)
     {
-        if (!read_image(argv[j]))
-        {
-            printf("failed to load image: %s\n", argv[j]);
-            exit(2);
-        }
+        fprintf(stderr, "instruction budget of %llu exhausted at x%04X\n", (unsigned long long)instr_budget,
+                registers[R_PC]);
+        history_dump("budget exhausted", 0);
     }
+    else
+    {
+        fprintf(stderr, "illegal opcode %s (x%04X) at x%04X\n", op_names[instruction >> 12], instruction,
+                registers[R_PC] - 1);
+        history_dump("illegal opcode", 0);
+    }
+}
 
+// Run the loaded program from PC_START until it halts
+int vm_run(void)
+{
     // Set program counter to starting position
     enum
     {
         PC_START = 0x3000
     };
-    registers[R_PC] = PC_START;
+    // The loop reads PC from a local so it stays in a register. Every write also goes to
+    // registers[R_PC], which probes, dumps and the reports read
+    uint16_t pc = PC_START;
+    registers[R_PC] = pc;
+
+    // Like the LC-3 after reset, Z is set so BRz and BRnzp are taken before any compare
+    registers[R_COND] = FL_ZRO;
+    history_enter(pc);
+    INSTRUMENT(if (callgraph_path) callgraph_start(PC_START));
 
+    int status = VM_HALTED;
     int running = 1;
     while (running)
     {
+        if (instret == instr_budget)
+        {
+            status = VM_BUDGET;
+            report_stop(status, 0);
+            break;
+        }
+
+        INSTRUMENT(pc_counts[pc]++);
+        INSTRUMENT(if (call_nodes) call_nodes[call_current].self++);
+
         // Read instruction at program counter and increment
-        uint16_t instruction = mem_read(registers[R_PC]++);
+        fetch_pc = pc;
+        uint16_t instruction = mem_fetch(pc);
+        registers[R_PC] = ++pc;
         uint16_t op = instruction >> 12;
 
+        instret++;
+        INSTRUMENT(stat_ops[op]++);
+        INSTRUMENT(if (tracer) trace_begin(pc - 1, instruction));
+
         // Execute op
         switch (op)
         {
@@ -186,6 +2601,8 @@ int main(int argc, const char *argv[])
 
             if (imm_flag)
             {
+                INSTRUMENT(stat_variants[VAR_ADD_IMM]++);
+
                 // sign extend the right most 5 bits
                 uint16_t imm5 = sign_extend(instruction & 0x1F, 5);
 
@@ -194,6 +2611,8 @@ int main(int argc, const char *argv[])
             }
             else
             {
+                INSTRUMENT(stat_variants[VAR_ADD_REG]++);
+
                 // Get SR2 (right operand), bits 0 to 2
                 uint16_t r2 = instruction & 0x7;
 
@@ -214,10 +2633,12 @@ int main(int argc, const char *argv[])
             uint16_t r1 = (instruction >> 6) & 0x7;
 
             // Read the imm flag in bit 5
-            uint16_t imm_flag = (instruction >> 5) && 0x1;
+            uint16_t imm_flag = (instruction >> 5) & 0x1;
 
             if (imm_flag)
             {
+                INSTRUMENT(stat_variants[VAR_AND_IMM]++);
+
                 // Sign extend right most 5 bits
                 uint16_t imm5 = sign_extend(instruction & 0x1F, 5);
 
@@ -226,6 +2647,8 @@ int main(int argc, const char *argv[])
             }
             else
             {
+                INSTRUMENT(stat_variants[VAR_AND_REG]++);
+
                 // Get SR2, bits 0 to 2
                 uint16_t r2 = instruction & 0x7;
 
@@ -252,42 +2675,72 @@ int main(int argc, const char *argv[])
         {
             // Get conditional bits 9 to 11
             uint16_t cond = (instruction >> 9) & 0x7;
+            INSTRUMENT(stat_variants[(cond & registers[R_COND]) ? VAR_BR_TAKEN : VAR_BR_NOT_TAKEN]++);
+            INSTRUMENT(if (branch_sites) branch_count(pc - 1, cond & registers[R_COND]));
 
             // Mask cond bits with conditional register
             if (cond & registers[R_COND])
-                registers[R_PC] += sign_extend(instruction & 0x1FF, 9);
+            {
+                uint16_t offset = sign_extend(instruction & 0x1FF, 9);
+                registers[R_PC] = pc += offset;
+
+                // Short backward branches are candidates for a busy-wait loop. Only look at
+                // loops that polled the keyboard, or branches to themselves
+                if ((int16_t)offset < 0 && (int16_t)offset >= -IDLE_LOOP_MAX && (idle_polled || offset == 0xFFFF))
+                    idle_check(pc);
+                history_enter(pc);
+                LC3_PROBE_BLOCK(pc);
+                if (dump_requested)
+                    dump_state();
+            }
         }
         break;
         case OP_JMP:
         {
             // Get BaseR bits 6 to 8
             uint16_t br = (instruction >> 6) & 0x7;
+            INSTRUMENT(stat_variants[br == R_R7 ? VAR_RET : VAR_JMP]++);
+            INSTRUMENT(if (call_nodes && br == R_R7) call_leave());
 
             // Set PC to br
-            registers[R_PC] = registers[br];
+            registers[R_PC] = pc = registers[br];
+            history_enter(pc);
+            LC3_PROBE_BLOCK(pc);
+            if (dump_requested)
+                dump_state();
         }
         break;
         case OP_JSR:
         {
-            // Save PC to r7
-            registers[R_R7] = registers[R_PC];
+            // Return address, saved to r7 once the target is known
+            uint16_t ret = pc;
 
             // Read bit 11
             uint16_t b11 = (instruction >> 11) & 0x1;
 
             if (b11)
             {
-                // Set PC to PC (saved in r7) + sign extension of the last 11 bits
-                registers[R_PC] += sign_extend(instruction & 0x7FF, 11);
+                INSTRUMENT(stat_variants[VAR_JSR]++);
+
+                // Set PC to PC + sign extension of the last 11 bits
+                registers[R_PC] = pc += sign_extend(instruction & 0x7FF, 11);
             }
             else
             {
+                INSTRUMENT(stat_variants[VAR_JSRR]++);
+
                 // Get BaseR, bits 6 to 8
                 uint16_t br = (instruction >> 6) & 0x7;
 
-                // Set PC to value in br
-                registers[R_PC] = registers[br];
+                // Set PC to value in br. JSRR R7 jumps to the old R7
+                registers[R_PC] = pc = registers[br];
             }
+            registers[R_R7] = ret;
+            INSTRUMENT(if (call_nodes) call_enter(pc));
+            history_enter(pc);
+            LC3_PROBE_BLOCK(pc);
+            if (dump_requested)
+                dump_state();
         }
         break;
         case OP_LD:
@@ -299,7 +2752,8 @@ int main(int argc, const char *argv[])
             uint16_t offset = sign_extend(instruction & 0x1FF, 9);
 
             // Put the value at address PC + offset into DR
-            registers[r0] = mem_read(registers[R_PC] + offset);
+            registers[r0] = mem_read(pc + offset);
+            INSTRUMENT(if (tracer) trace_mem(pc + offset));
 
             update_condition(r0);
         }
@@ -313,10 +2767,11 @@ int main(int argc, const char *argv[])
             uint16_t offset = sign_extend(instruction & 0x1FF, 9);
 
             // Get address from memory at location PC + OFFSET
-            uint16_t addr = mem_read(registers[R_PC] + offset);
+            uint16_t addr = mem_read(pc + offset);
 
             // Populate DR with value at addr
-            r0 = mem_read(addr);
+            registers[r0] = mem_read(addr);
+            INSTRUMENT(if (tracer) trace_mem(addr));
 
             update_condition(r0);
         }
@@ -333,6 +2788,7 @@ int main(int argc, const char *argv[])
             uint16_t offset = sign_extend(instruction & 0x3F, 6);
 
             // Populate DR with value in base register br + offset
+            INSTRUMENT(if (tracer) trace_mem(registers[br] + offset));
             registers[r0] = mem_read(registers[br] + offset);
 
             update_condition(r0);
@@ -347,7 +2803,7 @@ int main(int argc, const char *argv[])
             uint16_t offset = sign_extend(instruction & 0x1FF, 9);
 
             // Populate DR with address calculated by PC + offset
-            registers[r0] = registers[R_PC] + offset;
+            registers[r0] = pc + offset;
 
             update_condition(r0);
         }
@@ -361,7 +2817,8 @@ int main(int argc, const char *argv[])
             uint16_t offset = sign_extend(instruction & 0x1FF, 9);
 
             // Write value in r0 to mem addr PC + offset
-            mem_write(registers[R_PC] + offset, registers[r0]);
+            mem_write(pc + offset, registers[r0]);
+            INSTRUMENT(if (tracer) trace_mem(pc + offset));
         }
         break;
         case OP_STI:
@@ -373,10 +2830,11 @@ int main(int argc, const char *argv[])
             uint16_t offset = sign_extend(instruction & 0x1FF, 9);
 
             // Get address by reading memory at PC + offset
-            uint16_t addr = mem_read(registers[R_PC] + offset);
+            uint16_t addr = mem_read(pc + offset);
 
             // Write value in r0 to address at the address PC + offset
             mem_write(addr, registers[r0]);
+            INSTRUMENT(if (tracer) trace_mem(addr));
         }
         break;
         case OP_STR:
@@ -388,84 +2846,415 @@ int main(int argc, const char *argv[])
             uint16_t br = (instruction >> 6) & 0x7;
 
             // Sign extend the last 6 bits to get offset
-            uint16_t offset = sign_extend(instruction & 0x2F, 6);
+            uint16_t offset = sign_extend(instruction & 0x3F, 6);
 
             // Write value in r0 to addr of BaseR + offset
             mem_write(registers[br] + offset, registers[r0]);
+            INSTRUMENT(if (tracer) trace_mem(registers[br] + offset));
         }
         break;
         case OP_TRAP:
         {
+            idle_dirty = 1;
+            trap_count++;
+
+            // The routines are native, but R7 gets the return address as on the LC-3
+            registers[R_R7] = pc;
+            INSTRUMENT(stat_traps[instruction & 0xFF]++);
+            INSTRUMENT(if (call_nodes) call_trap(instruction & 0xFF));
+            LC3_PROBE2(trap__entry, instruction & 0xFF, pc - 1);
             switch (instruction & 0xFF)
             {
             case TRAP_GETC:
             {
                 // Store ascii char in register 0
-                registers[R_R0] = (uint16_t)getchar();
+                registers[R_R0] = (uint16_t)con_getc();
             }
             break;
             case TRAP_OUT:
             {
-                putc((char)registers[R_R0], stdout);
-                fflush(stdout);
+                con_putc((char)registers[R_R0]);
+                con_flush();
             }
             break;
             case TRAP_PUTS:
             {
-                // Get memory
-                uint16_t *c = memory + registers[R_R0];
-                while (*c)
-                {
-                    putc((char)*c, stdout);
-                    ++c;
-                }
+                // The address wraps like any other, a string need not end before xFFFF
+                uint16_t addr = registers[R_R0];
+                for (uint16_t word; (word = mem_peek(addr)); ++addr)
+                    con_putc((char)word);
 
-                fflush(stdout);
+                con_flush();
             }
             break;
             case TRAP_IN:
             {
-                printf("Enter a character: ");
-                char c = getchar();
-                putc(c, stdout);
+                con_puts("Enter a character: ");
+
+                // Characters are zero extended like GETC's, end of input is xFFFF
+                int c = con_getc();
+                if (c >= 0)
+                    con_putc(c);
                 registers[R_R0] = (uint16_t)c;
             }
             break;
             case TRAP_PUTSP:
             {
-                uint16_t *c = memory + registers[R_R0];
-                while (*c)
+                uint16_t addr = registers[R_R0];
+                for (uint16_t word; (word = mem_peek(addr)); ++addr)
                 {
                     // First 8 bits
-                    char c1 = (*c) & 0xFF;
-                    putc(c1, stdout);
+                    char c1 = word & 0xFF;
+                    con_putc(c1);
 
                     // Next 8 bits
-                    char c2 = (*c) >> 8;
+                    char c2 = word >> 8;
                     if (c2)
-                        putc(c2, stdout);
-
-                    ++c;
+                        con_putc(c2);
                 }
-                fflush(stdout);
+                con_flush();
             }
             break;
             case TRAP_HALT:
             {
-                puts("HALT");
-                fflush(stdout);
+                LC3_PROBE1(halt, instret);
+                con_puts("HALT\n");
+                con_sync();
                 running = 0;
             }
             break;
             }
+            LC3_PROBE2(trap__exit, instruction & 0xFF, registers[R_R0]);
+            if (dump_requested)
+                dump_state();
         }
         break;
         case OP_RES:
         case OP_RTI:
         default:
         {
+            // There is no supervisor mode or interrupt to return from, so RTI is as illegal as RES
+            status = VM_ILLEGAL;
+            report_stop(status, instruction);
+            running = 0;
         }
         break;
         }
     }
-}
\ No newline at end of file
+    return status;
+}
+
+// Clear the guest machine and its symbols, so this thread can run another image.
+// Console channels and profilers are left as they are
+void vm_reset(void)
+{
+    memset(memory, 0, sizeof(memory));
+    memset(registers, 0, sizeof(registers));
+    memset(history, 0, sizeof(history));
+    history_blocks = 0;
+    instret = 0;
+    trap_count = 0;
+
+    idle_pc = 0;
+    idle_polled = 0;
+    idle_dirty = 1;
+
+    for (size_t i = 0; i < symbol_count; i++)
+        free(symbols[i].name);
+    free(symbols);
+    symbols = NULL;
+    symbol_count = 0;
+}
+
+// Programs that embed the VM, like the benchmarks, include this file with LC3_NO_MAIN
+#ifndef LC3_NO_MAIN
+
+// lc3 asm [-o image.obj] source.asm writes the image and a .sym next to it, the image
+// defaults to the source with .obj
+int asm_main(int argc, const char *argv[])
+{
+    const char *source_path = NULL;
+    const char *image_path = NULL;
+
+    for (int j = 1; j < argc; j++)
+    {
+        if (strcmp(argv[j], "-o") == 0 && j + 1 < argc)
+        {
+            image_path = argv[++j];
+        }
+        else if (argv[j][0] != '-' && !source_path)
+        {
+            source_path = argv[j];
+        }
+        else
+        {
+            source_path = NULL;
+            break;
+        }
+    }
+    if (!source_path)
+    {
+        printf("lc3 asm [-o image.obj] source.asm\n");
+        exit(2);
+    }
+
+    // prog.asm -> prog.obj, and the symbols go next to the image
+    const char *name = image_path ? image_path : source_path;
+    const char *dot = strrchr(name, '.');
+    const char *slash = strrchr(name, '/');
+    int stem = (dot && (!slash || dot > slash)) ? (int)(dot - name) : (int)strlen(name);
+
+    char obj_path[4096], sym_path[4096];
+    if (image_path)
+        snprintf(obj_path, sizeof(obj_path), "%s", image_path);
+    else
+        snprintf(obj_path, sizeof(obj_path), "%.*s.obj", stem, name);
+    snprintf(sym_path, sizeof(sym_path), "%.*s.sym", stem, name);
+
+    size_t len;
+    char *source = (char *)read_file(source_path, &len);
+    if (!source)
+    {
+        printf("failed to read source: %s\n", source_path);
+        exit(2);
+    }
+
+    struct asm_program program;
+    if (!assemble(source, len, &program))
+    {
+        printf("%s: %s\n", source_path, program.error);
+        return 1;
+    }
+
+    FILE *obj = fopen(obj_path, "wb");
+    FILE *sym = fopen(sym_path, "w");
+    int written = obj && sym && asm_write_obj(&program, obj) && asm_write_sym(&program, sym);
+    if (obj)
+        written &= fclose(obj) == 0;
+    if (sym)
+        written &= fclose(sym) == 0;
+    if (!written)
+    {
+        printf("failed to write %s and %s\n", obj_path, sym_path);
+        return 1;
+    }
+
+    asm_free(&program);
+    free(source);
+    return 0;
+}
+
+int main(int argc, const char *argv[])
+{
+    if (argc > 1 && strcmp(argv[1], "asm") == 0)
+        return asm_main(argc - 1, argv + 1);
+
+    int images = 0;
+    int async_io = 0;
+    int sample_hz = 0;
+
+    for (int j = 1; j < argc; j++)
+    {
+        if (strcmp(argv[j], "--input") == 0 && j + 1 < argc)
+        {
+            if (!console_input_file(argv[++j]))
+            {
+                printf("failed to open input: %s\n", argv[j]);
+                exit(2);
+            }
+        }
+        else if (strcmp(argv[j], "--output") == 0 && j + 1 < argc)
+        {
+            if (!console_output_file(argv[++j]))
+            {
+                printf("failed to open output: %s\n", argv[j]);
+                exit(2);
+            }
+        }
+        else if (strcmp(argv[j], "--ring-out") == 0 && j + 1 < argc)
+        {
+            if (!console_output_ring(argv[++j], RING_OUT_SIZE))
+            {
+                printf("failed to create ring: %s\n", argv[j]);
+                exit(2);
+            }
+        }
+        else if (strcmp(argv[j], "--ring-in") == 0 && j + 1 < argc)
+        {
+            if (!console_input_ring(argv[++j], RING_IN_SIZE))
+            {
+                printf("failed to create ring: %s\n", argv[j]);
+                exit(2);
+            }
+        }
+        else if (strcmp(argv[j], "--async-io") == 0)
+        {
+            async_io = 1;
+        }
+        else if (strcmp(argv[j], "--stats") == 0)
+        {
+#ifdef LC3_INSTRUMENT
+            atexit(report_stats);
+#else
+            printf("--stats needs a build with -DLC3_INSTRUMENT\n");
+            exit(2);
+#endif
+        }
+        else if (strcmp(argv[j], "--profile") == 0)
+        {
+#ifdef LC3_INSTRUMENT
+            atexit(report_profile);
+#else
+            printf("--profile needs a build with -DLC3_INSTRUMENT\n");
+            exit(2);
+#endif
+        }
+        else if (strcmp(argv[j], "--callgraph") == 0 && j + 1 < argc)
+        {
+#ifdef LC3_INSTRUMENT
+            callgraph_path = argv[++j];
+            atexit(report_callgraph);
+#else
+            printf("--callgraph needs a build with -DLC3_INSTRUMENT\n");
+            exit(2);
+#endif
+        }
+        else if (strcmp(argv[j], "--branches") == 0 && j + 1 < argc)
+        {
+#ifdef LC3_INSTRUMENT
+            branches_path = argv[++j];
+            branch_sites = calloc(UINT16_MAX + 1, sizeof(*branch_sites));
+            atexit(report_branches);
+#else
+            printf("--branches needs a build with -DLC3_INSTRUMENT\n");
+            exit(2);
+#endif
+        }
+        else if (strcmp(argv[j], "--trace") == 0 && j + 1 < argc)
+        {
+#ifdef LC3_INSTRUMENT
+            if (!trace_open(argv[++j]))
+            {
+                printf("failed to open trace: %s\n", argv[j]);
+                exit(2);
+            }
+            atexit(trace_close);
+#else
+            printf("--trace needs a build with -DLC3_INSTRUMENT\n");
+            exit(2);
+#endif
+        }
+        else if (strcmp(argv[j], "--heatmap") == 0)
+        {
+#ifdef LC3_INSTRUMENT
+            heat_pages = calloc(HEAT_PAGE_COUNT, sizeof(*heat_pages));
+            heat_words = calloc(UINT16_MAX + 1, 1);
+            atexit(report_heatmap);
+#else
+            printf("--heatmap needs a build with -DLC3_INSTRUMENT\n");
+            exit(2);
+#endif
+        }
+        else if (strcmp(argv[j], "--sample") == 0 && j + 1 < argc)
+        {
+            sample_hz = atoi(argv[++j]);
+        }
+        else if (strcmp(argv[j], "--hw-counters") == 0)
+        {
+            if (!hw_open())
+            {
+                if (errno == EACCES || errno == EPERM)
+                    printf("hardware counters not permitted, see /proc/sys/kernel/perf_event_paranoid\n");
+                else
+                    printf("failed to open hardware counters: %s\n", strerror(errno));
+                exit(2);
+            }
+            atexit(report_hw_counters);
+        }
+        else if (strcmp(argv[j], "--stats-shm") == 0 && j + 1 < argc)
+        {
+            stats_name = argv[++j];
+        }
+        else if (strcmp(argv[j], "--budget") == 0 && j + 1 < argc)
+        {
+            instr_budget = strtoull(argv[++j], NULL, 0);
+        }
+        else if (strcmp(argv[j], "--top") == 0 && j + 1 < argc)
+        {
+            report_top = atoi(argv[++j]);
+        }
+        else if (!read_image(argv[j])) // Make sure programs can be read
+        {
+            printf("failed to load image: %s\n", argv[j]);
+            exit(2);
+        }
+        else
+        {
+            images++;
+        }
+    }
+
+    // Check for code passed to vm
+    if (images == 0)
+    {
+        printf("lc3 [--input file] [--output file] [--ring-in name] [--ring-out name] [--async-io] [--stats] [--profile] [--callgraph file] [--branches file] [--trace file] [--heatmap] [--sample hz] [--hw-counters] [--stats-shm name] [--budget n] [--top n] [image-file1] ..\n");
+        exit(2);
+    }
+
+    struct sigaction dump = {.sa_handler = handle_dump_signal};
+    sigaction(SIGQUIT, &dump, NULL);
+    sigaction(SIGTERM, &dump, NULL);
+
+    struct sigaction request = {.sa_handler = handle_dump_request, .sa_flags = SA_RESTART};
+    sigaction(SIGUSR1, &request, NULL);
+
+    int tty = con_in.kind == CHAN_STDIO && isatty(STDIN_FILENO);
+    if (tty)
+    {
+        signal(SIGINT, handle_interrupt);
+        disable_input_buffering();
+    }
+    else if (con_in.kind == CHAN_STDIO)
+    {
+        console_input_stdin();
+    }
+
+    if (async_io)
+    {
+        if (con_out.kind == CHAN_STDIO)
+            console_output_stdout();
+        console_async();
+    }
+
+    if (sample_hz)
+    {
+        if (!start_sampling(sample_hz))
+        {
+            printf("failed to start sampling at %d Hz\n", sample_hz);
+            exit(2);
+        }
+        atexit(report_samples);
+    }
+
+    if (stats_name)
+    {
+        if (!start_stats(stats_name))
+        {
+            printf("failed to create stats segment: %s\n", stats_name);
+            exit(2);
+        }
+        atexit(stop_stats);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    hw_start();
+    int status = vm_run();
+    jobs_completed++;
+    hw_stop();
+    console_close();
+
+    if (tty)
+        restore_input_buffering();
+    return status;
+}
+#endif
@@ -0,0 +1,825 @@
+// Conformance tests for the interpreter, run by `make check`
+//
+//   conformance [-v] [case ..]
+//
+// Every case is a few hand-assembled instructions at x3000 and the machine state
+// around them. The case runs for exactly .steps instructions, by way of the
+// instruction budget, and then everything is compared against the golden state:
+// R0-R7, PC, COND, all of memory, the console output and how the engine stopped.
+// Memory must equal .mem with .expect written over it, so stray stores fail too.
+// Each case runs on every engine of bench/engines.h.
+//
+// Like vm_run, registers start at zero, COND at Z and the TRAP routines are native.
+// They set R7 and return xFFFF from GETC and IN at the end of input.
+#define LC3_NO_MAIN
+#include "../src/vm.c"
+#include "../bench/engines.h"
+
+enum
+{
+    CODE_MAX = 4,
+    MEM_MAX = 4,
+};
+
+// How the case ends. Most run out of budget right after their last instruction
+enum
+{
+    STOP_BUDGET,
+    STOP_HALT,
+    STOP_ILLEGAL,
+};
+
+struct word
+{
+    uint16_t addr;
+    uint16_t value;
+};
+
+struct test_case
+{
+    const char *name;
+    int steps;                   // Instructions to execute
+    uint16_t code[CODE_MAX];     // Loaded at x3000
+    uint16_t in[R_COUNT];        // R0-R7 before the run, vm_run sets PC and COND
+    struct word mem[MEM_MAX];    // Other memory before the run
+    const char *input;           // Console input, NULL for none
+    uint16_t out[R_COUNT];       // Registers after the run
+    struct word expect[MEM_MAX]; // Memory the case writes
+    const char *output;          // Console output, NULL for none
+    int stop;
+};
+
+const struct test_case cases[] = {
+    {
+        .name = "ADD register",
+        .steps = 1,
+        .code = {
+            0x1283, // ADD R1, R2, R3
+        },
+        .in = {[R_R2] = 0x0005, [R_R3] = 0x0007},
+        .out = {[R_R1] = 0x000C, [R_R2] = 0x0005, [R_R3] = 0x0007, [R_PC] = 0x3001, [R_COND] = FL_POS},
+    },
+    {
+        .name = "ADD immediate #15",
+        .steps = 1,
+        .code = {
+            0x126F, // ADD R1, R1, #15
+        },
+        .in = {[R_R1] = 0x0001},
+        .out = {[R_R1] = 0x0010, [R_PC] = 0x3001, [R_COND] = FL_POS},
+    },
+    {
+        .name = "ADD immediate #-16 sign extends",
+        .steps = 1,
+        .code = {
+            0x12B0, // ADD R1, R2, #-16
+        },
+        .in = {[R_R2] = 0x0010},
+        .out = {[R_R2] = 0x0010, [R_PC] = 0x3001, [R_COND] = FL_ZRO},
+    },
+    {
+        .name = "ADD overflows to negative",
+        .steps = 1,
+        .code = {
+            0x1021, // ADD R0, R0, #1
+        },
+        .in = {[R_R0] = 0x7FFF},
+        .out = {[R_R0] = 0x8000, [R_PC] = 0x3001, [R_COND] = FL_NEG},
+    },
+    {
+        .name = "ADD wraps past xFFFF to zero",
+        .steps = 1,
+        .code = {
+            0x1001, // ADD R0, R0, R1
+        },
+        .in = {[R_R0] = 0xFFFF, [R_R1] = 0x0001},
+        .out = {[R_R1] = 0x0001, [R_PC] = 0x3001, [R_COND] = FL_ZRO},
+    },
+    {
+        .name = "ADD with the destination as both sources",
+        .steps = 1,
+        .code = {
+            0x16C3, // ADD R3, R3, R3
+        },
+        .in = {[R_R3] = 0x4000},
+        .out = {[R_R3] = 0x8000, [R_PC] = 0x3001, [R_COND] = FL_NEG},
+    },
+    {
+        .name = "AND register",
+        .steps = 1,
+        .code = {
+            0x5042, // AND R0, R1, R2
+        },
+        .in = {[R_R1] = 0x0FF0, [R_R2] = 0x3C3C},
+        .out = {[R_R0] = 0x0C30, [R_R1] = 0x0FF0, [R_R2] = 0x3C3C, [R_PC] = 0x3001, [R_COND] = FL_POS},
+    },
+    {
+        .name = "AND immediate #-1 keeps every bit",
+        .steps = 1,
+        .code = {
+            0x507F, // AND R0, R1, #-1
+        },
+        .in = {[R_R1] = 0x8001},
+        .out = {[R_R0] = 0x8001, [R_R1] = 0x8001, [R_PC] = 0x3001, [R_COND] = FL_NEG},
+    },
+    {
+        .name = "AND immediate #0 clears",
+        .steps = 1,
+        .code = {
+            0x5B60, // AND R5, R5, #0
+        },
+        .in = {[R_R5] = 0x1234},
+        .out = {[R_PC] = 0x3001, [R_COND] = FL_ZRO},
+    },
+    {
+        .name = "AND immediate #-16 sign extends to xFFF0",
+        .steps = 1,
+        .code = {
+            0x5070, // AND R0, R1, #-16
+        },
+        .in = {[R_R1] = 0x00FF},
+        .out = {[R_R0] = 0x00F0, [R_R1] = 0x00FF, [R_PC] = 0x3001, [R_COND] = FL_POS},
+    },
+    {
+        .name = "NOT",
+        .steps = 1,
+        .code = {
+            0x907F, // NOT R0, R1
+        },
+        .in = {[R_R1] = 0x00FF},
+        .out = {[R_R0] = 0xFF00, [R_R1] = 0x00FF, [R_PC] = 0x3001, [R_COND] = FL_NEG},
+    },
+    {
+        .name = "NOT of xFFFF is zero",
+        .steps = 1,
+        .code = {
+            0x94BF, // NOT R2, R2
+        },
+        .in = {[R_R2] = 0xFFFF},
+        .out = {[R_PC] = 0x3001, [R_COND] = FL_ZRO},
+    },
+    {
+        .name = "BRz is taken on the flags after reset",
+        .steps = 1,
+        .code = {
+            0x0404, // BRz #4
+        },
+        .out = {[R_PC] = 0x3005, [R_COND] = FL_ZRO},
+    },
+    {
+        .name = "BRnp is not taken on Z",
+        .steps = 1,
+        .code = {
+            0x0A04, // BRnp #4
+        },
+        .out = {[R_PC] = 0x3001, [R_COND] = FL_ZRO},
+    },
+    {
+        .name = "BRn is taken after a negative result",
+        .steps = 2,
+        .code = {
+            0x103F, // ADD R0, R0, #-1
+            0x09FE, // BRn #-2
+        },
+        .out = {[R_R0] = 0xFFFF, [R_PC] = 0x3000, [R_COND] = FL_NEG},
+    },
+    {
+        .name = "BRzp is not taken after a negative result",
+        .steps = 2,
+        .code = {
+            0x103F, // ADD R0, R0, #-1
+            0x0605, // BRzp #5
+        },
+        .out = {[R_R0] = 0xFFFF, [R_PC] = 0x3002, [R_COND] = FL_NEG},
+    },
+    {
+        .name = "BRp maximum offset",
+        .steps = 2,
+        .code = {
+            0x1021, // ADD R0, R0, #1
+            0x02FF, // BRp #255
+        },
+        .out = {[R_R0] = 0x0001, [R_PC] = 0x3101, [R_COND] = FL_POS},
+    },
+    {
+        .name = "BRnzp minimum offset",
+        .steps = 1,
+        .code = {
+            0x0F00, // BRnzp #-256
+        },
+        .out = {[R_PC] = 0x2F01, [R_COND] = FL_ZRO},
+    },
+    {
+        .name = "BR without condition bits is never taken",
+        .steps = 1,
+        .code = {
+            0x01FF, // BR #-1, no condition bits
+        },
+        .out = {[R_PC] = 0x3001, [R_COND] = FL_ZRO},
+    },
+    {
+        .name = "BR target wraps past xFFFF",
+        .steps = 2,
+        .code = {
+            0xC040, // JMP R1
+        },
+        .in = {[R_R1] = 0xFFFD},
+        .mem = {
+            {0xFFFD, 0x0E03}, // BRnzp #3
+        },
+        .out = {[R_R1] = 0xFFFD, [R_PC] = 0x0001, [R_COND] = FL_ZRO},
+    },
+    {
+        .name = "JMP",
+        .steps = 1,
+        .code = {
+            0xC080, // JMP R2
+        },
+        .in = {[R_R2] = 0x4000},
+        .out = {[R_R2] = 0x4000, [R_PC] = 0x4000, [R_COND] = FL_ZRO},
+    },
+    {
+        .name = "RET",
+        .steps = 1,
+        .code = {
+            0xC1C0, // RET
+        },
+        .in = {[R_R7] = 0x3456},
+        .out = {[R_R7] = 0x3456, [R_PC] = 0x3456, [R_COND] = FL_ZRO},
+    },
+    {
+        .name = "JSR saves the return address in R7",
+        .steps = 1,
+        .code = {
+            0x4810, // JSR #16
+        },
+        .out = {[R_R7] = 0x3001, [R_PC] = 0x3011, [R_COND] = FL_ZRO},
+    },
+    {
+        .name = "JSR minimum offset",
+        .steps = 1,
+        .code = {
+            0x4C00, // JSR #-1024
+        },
+        .out = {[R_R7] = 0x3001, [R_PC] = 0x2C01, [R_COND] = FL_ZRO},
+    },
+    {
+        .name = "JSR target wraps past xFFFF",
+        .steps = 2,
+        .code = {
+            0xC040, // JMP R1
+        },
+        .in = {[R_R1] = 0xFFF0},
+        .mem = {
+            {0xFFF0, 0x4864}, // JSR #100
+        },
+        .out = {[R_R1] = 0xFFF0, [R_R7] = 0xFFF1, [R_PC] = 0x0055, [R_COND] = FL_ZRO},
+    },
+    {
+        .name = "JSRR",
+        .steps = 1,
+        .code = {
+            0x40C0, // JSRR R3
+        },
+        .in = {[R_R3] = 0x5000},
+        .out = {[R_R3] = 0x5000, [R_R7] = 0x3001, [R_PC] = 0x5000, [R_COND] = FL_ZRO},
+    },
+    {
+        .name = "JSRR R7 jumps to the old R7",
+        .steps = 1,
+        .code = {
+            0x41C0, // JSRR R7
+        },
+        .in = {[R_R7] = 0x4000},
+        .out = {[R_R7] = 0x3001, [R_PC] = 0x4000, [R_COND] = FL_ZRO},
+    },
+    {
+        .name = "LD",
+        .steps = 1,
+        .code = {
+            0x2002, // LD R0, #2
+        },
+        .mem = {
+            {0x3003, 0x1234},
+        },
+        .out = {[R_R0] = 0x1234, [R_PC] = 0x3001, [R_COND] = FL_POS},
+    },
+    {
+        .name = "LD negative offset and value",
+        .steps = 1,
+        .code = {
+            0x23FE, // LD R1, #-2
+        },
+        .mem = {
+            {0x2FFF, 0x8000},
+        },
+        .out = {[R_R1] = 0x8000, [R_PC] = 0x3001, [R_COND] = FL_NEG},
+    },
+    {
+        .name = "LD of zero sets Z",
+        .steps = 2,
+        .code = {
+            0x1021, // ADD R0, R0, #1
+            0x2001, // LD R0, #1
+        },
+        .out = {[R_PC] = 0x3002, [R_COND] = FL_ZRO},
+    },
+    {
+        .name = "LD maximum offset",
+        .steps = 1,
+        .code = {
+            0x24FF, // LD R2, #255
+        },
+        .mem = {
+            {0x3100, 0x7FFF},
+        },
+        .out = {[R_R2] = 0x7FFF, [R_PC] = 0x3001, [R_COND] = FL_POS},
+    },
+    {
+        .name = "LD address wraps past xFFFF",
+        .steps = 2,
+        .code = {
+            0xC040, // JMP R1
+        },
+        .in = {[R_R1] = 0xFFFE},
+        .mem = {
+            {0x0000, 0x4242},
+            {0xFFFE, 0x2001}, // LD R0, #1
+        },
+        .out = {[R_R0] = 0x4242, [R_R1] = 0xFFFE, [R_PC] = 0xFFFF, [R_COND] = FL_POS},
+    },
+    {
+        .name = "LDI",
+        .steps = 1,
+        .code = {
+            0xA001, // LDI R0, #1
+        },
+        .mem = {
+            {0x3002, 0x4000},
+            {0x4000, 0xBEEF},
+        },
+        .out = {[R_R0] = 0xBEEF, [R_PC] = 0x3001, [R_COND] = FL_NEG},
+    },
+    {
+        .name = "LDI pointer address wraps past xFFFF",
+        .steps = 2,
+        .code = {
+            0xC040, // JMP R1
+        },
+        .in = {[R_R1] = 0xFFFF},
+        .mem = {
+            {0x0005, 0x0042},
+            {0xFFFE, 0x0005},
+            {0xFFFF, 0xA5FE}, // LDI R2, #-2
+        },
+        .out = {[R_R1] = 0xFFFF, [R_R2] = 0x0042, [R_PC] = 0x0000, [R_COND] = FL_POS},
+    },
+    {
+        .name = "LDR maximum offset",
+        .steps = 1,
+        .code = {
+            0x605F, // LDR R0, R1, #31
+        },
+        .in = {[R_R1] = 0x4000},
+        .mem = {
+            {0x401F, 0x0077},
+        },
+        .out = {[R_R0] = 0x0077, [R_R1] = 0x4000, [R_PC] = 0x3001, [R_COND] = FL_POS},
+    },
+    {
+        .name = "LDR minimum offset",
+        .steps = 1,
+        .code = {
+            0x6060, // LDR R0, R1, #-32
+        },
+        .in = {[R_R1] = 0x4000},
+        .mem = {
+            {0x3FE0, 0xF00D},
+        },
+        .out = {[R_R0] = 0xF00D, [R_R1] = 0x4000, [R_PC] = 0x3001, [R_COND] = FL_NEG},
+    },
+    {
+        .name = "LDR address wraps past xFFFF",
+        .steps = 1,
+        .code = {
+            0x6042, // LDR R0, R1, #2
+        },
+        .in = {[R_R1] = 0xFFFF},
+        .mem = {
+            {0x0001, 0x0011},
+        },
+        .out = {[R_R0] = 0x0011, [R_R1] = 0xFFFF, [R_PC] = 0x3001, [R_COND] = FL_POS},
+    },
+    {
+        .name = "LEA sets the flags",
+        .steps = 1,
+        .code = {
+            0xE7FF, // LEA R3, #-1
+        },
+        .out = {[R_R3] = 0x3000, [R_PC] = 0x3001, [R_COND] = FL_POS},
+    },
+    {
+        .name = "LEA address wraps past xFFFF",
+        .steps = 2,
+        .code = {
+            0xC040, // JMP R1
+        },
+        .in = {[R_R1] = 0xFFF0},
+        .mem = {
+            {0xFFF0, 0xE00F}, // LEA R0, #15
+        },
+        .out = {[R_R1] = 0xFFF0, [R_PC] = 0xFFF1, [R_COND] = FL_ZRO},
+    },
+    {
+        .name = "ST over its own instruction",
+        .steps = 1,
+        .code = {
+            0x31FF, // ST R0, #-1
+        },
+        .in = {[R_R0] = 0xABCD},
+        .out = {[R_R0] = 0xABCD, [R_PC] = 0x3001, [R_COND] = FL_ZRO},
+        .expect = {
+            {0x3000, 0xABCD},
+        },
+    },
+    {
+        .name = "ST leaves the flags",
+        .steps = 2,
+        .code = {
+            0x103F, // ADD R0, R0, #-1
+            0x3005, // ST R0, #5
+        },
+        .out = {[R_R0] = 0xFFFF, [R_PC] = 0x3002, [R_COND] = FL_NEG},
+        .expect = {
+            {0x3007, 0xFFFF},
+        },
+    },
+    {
+        .name = "ST address wraps past xFFFF",
+        .steps = 2,
+        .code = {
+            0xC040, // JMP R1
+        },
+        .in = {[R_R0] = 0x1111, [R_R1] = 0xFFFF},
+        .mem = {
+            {0xFFFF, 0x3005}, // ST R0, #5
+        },
+        .out = {[R_R0] = 0x1111, [R_R1] = 0xFFFF, [R_PC] = 0x0000, [R_COND] = FL_ZRO},
+        .expect = {
+            {0x0005, 0x1111},
+        },
+    },
+    {
+        .name = "STI",
+        .steps = 1,
+        .code = {
+            0xB401, // STI R2, #1
+        },
+        .in = {[R_R2] = 0x2222},
+        .mem = {
+            {0x3002, 0x4000},
+        },
+        .out = {[R_R2] = 0x2222, [R_PC] = 0x3001, [R_COND] = FL_ZRO},
+        .expect = {
+            {0x4000, 0x2222},
+        },
+    },
+    {
+        .name = "STR offset with bit 4 set",
+        .steps = 1,
+        .code = {
+            0x7050, // STR R0, R1, #16
+        },
+        .in = {[R_R0] = 0x0007, [R_R1] = 0x4000},
+        .out = {[R_R0] = 0x0007, [R_R1] = 0x4000, [R_PC] = 0x3001, [R_COND] = FL_ZRO},
+        .expect = {
+            {0x4010, 0x0007},
+        },
+    },
+    {
+        .name = "STR minimum offset",
+        .steps = 1,
+        .code = {
+            0x7060, // STR R0, R1, #-32
+        },
+        .in = {[R_R0] = 0x0007, [R_R1] = 0x4000},
+        .out = {[R_R0] = 0x0007, [R_R1] = 0x4000, [R_PC] = 0x3001, [R_COND] = FL_ZRO},
+        .expect = {
+            {0x3FE0, 0x0007},
+        },
+    },
+    {
+        .name = "STR address wraps past xFFFF",
+        .steps = 1,
+        .code = {
+            0x7041, // STR R0, R1, #1
+        },
+        .in = {[R_R0] = 0x0009, [R_R1] = 0xFFFF},
+        .out = {[R_R0] = 0x0009, [R_R1] = 0xFFFF, [R_PC] = 0x3001, [R_COND] = FL_ZRO},
+        .expect = {
+            {0x0000, 0x0009},
+        },
+    },
+    {
+        .name = "GETC",
+        .steps = 1,
+        .code = {
+            0xF020, // TRAP x20
+        },
+        .input = "A",
+        .out = {[R_R0] = 0x0041, [R_R7] = 0x3001, [R_PC] = 0x3001, [R_COND] = FL_ZRO},
+    },
+    {
+        .name = "GETC zero extends",
+        .steps = 1,
+        .code = {
+            0xF020, // TRAP x20
+        },
+        .input = "\xE9",
+        .out = {[R_R0] = 0x00E9, [R_R7] = 0x3001, [R_PC] = 0x3001, [R_COND] = FL_ZRO},
+    },
+    {
+        .name = "GETC at end of input",
+        .steps = 1,
+        .code = {
+            0xF020, // TRAP x20
+        },
+        .out = {[R_R0] = 0xFFFF, [R_R7] = 0x3001, [R_PC] = 0x3001, [R_COND] = FL_ZRO},
+    },
+    {
+        .name = "OUT writes the low byte",
+        .steps = 1,
+        .code = {
+            0xF021, // TRAP x21
+        },
+        .in = {[R_R0] = 0x1F41},
+        .out = {[R_R0] = 0x1F41, [R_R7] = 0x3001, [R_PC] = 0x3001, [R_COND] = FL_ZRO},
+        .output = "A",
+    },
+    {
+        .name = "PUTS",
+        .steps = 1,
+        .code = {
+            0xF022, // TRAP x22
+        },
+        .in = {[R_R0] = 0x4000},
+        .mem = {
+            {0x4000, 0x0048},
+            {0x4001, 0x0069},
+        },
+        .out = {[R_R0] = 0x4000, [R_R7] = 0x3001, [R_PC] = 0x3001, [R_COND] = FL_ZRO},
+        .output = "Hi",
+    },
+    {
+        .name = "PUTS wraps past xFFFF",
+        .steps = 1,
+        .code = {
+            0xF022, // TRAP x22
+        },
+        .in = {[R_R0] = 0xFFFF},
+        .mem = {
+            {0x0000, 0x0062},
+            {0xFFFF, 0x0061},
+        },
+        .out = {[R_R0] = 0xFFFF, [R_R7] = 0x3001, [R_PC] = 0x3001, [R_COND] = FL_ZRO},
+        .output = "ab",
+    },
+    {
+        .name = "IN prompts and echoes",
+        .steps = 1,
+        .code = {
+            0xF023, // TRAP x23
+        },
+        .input = "z",
+        .out = {[R_R0] = 0x007A, [R_R7] = 0x3001, [R_PC] = 0x3001, [R_COND] = FL_ZRO},
+        .output = "Enter a character: z",
+    },
+    {
+        .name = "IN at end of input",
+        .steps = 1,
+        .code = {
+            0xF023, // TRAP x23
+        },
+        .out = {[R_R0] = 0xFFFF, [R_R7] = 0x3001, [R_PC] = 0x3001, [R_COND] = FL_ZRO},
+        .output = "Enter a character: ",
+    },
+    {
+        .name = "PUTSP with an odd length",
+        .steps = 1,
+        .code = {
+            0xF024, // TRAP x24
+        },
+        .in = {[R_R0] = 0x4000},
+        .mem = {
+            {0x4000, 0x6968},
+            {0x4001, 0x0021},
+        },
+        .out = {[R_R0] = 0x4000, [R_R7] = 0x3001, [R_PC] = 0x3001, [R_COND] = FL_ZRO},
+        .output = "hi!",
+    },
+    {
+        .name = "HALT",
+        .steps = 1,
+        .code = {
+            0xF025, // TRAP x25
+        },
+        .out = {[R_R7] = 0x3001, [R_PC] = 0x3001, [R_COND] = FL_ZRO},
+        .output = "HALT\n",
+        .stop = STOP_HALT,
+    },
+    {
+        .name = "unknown trap vectors do nothing",
+        .steps = 1,
+        .code = {
+            0xF026, // TRAP x26
+        },
+        .out = {[R_R7] = 0x3001, [R_PC] = 0x3001, [R_COND] = FL_ZRO},
+    },
+    {
+        .name = "RTI is illegal",
+        .steps = 1,
+        .code = {
+            0x8000, // RTI
+        },
+        .out = {[R_PC] = 0x3001, [R_COND] = FL_ZRO},
+        .stop = STOP_ILLEGAL,
+    },
+    {
+        .name = "RES is illegal",
+        .steps = 1,
+        .code = {
+            0xD000, // RES
+        },
+        .out = {[R_PC] = 0x3001, [R_COND] = FL_ZRO},
+        .stop = STOP_ILLEGAL,
+    },
+    {
+        .name = "KBSR and KBDR with a key ready",
+        .steps = 2,
+        .code = {
+            0xA002, // LDI R0, #2
+            0xA202, // LDI R1, #2
+        },
+        .mem = {
+            {0x3003, 0xFE00},
+            {0x3004, 0xFE02},
+        },
+        .input = "k",
+        .out = {[R_R0] = 0x8000, [R_R1] = 0x006B, [R_PC] = 0x3002, [R_COND] = FL_POS},
+        .expect = {
+            {0xFE00, 0x8000},
+            {0xFE02, 0x006B},
+        },
+    },
+    {
+        .name = "KBSR at end of input",
+        .steps = 1,
+        .code = {
+            0x6040, // LDR R0, R1, #0
+        },
+        .in = {[R_R1] = 0xFE00},
+        .out = {[R_R0] = 0x8000, [R_R1] = 0xFE00, [R_PC] = 0x3001, [R_COND] = FL_NEG},
+        .expect = {
+            {0xFE00, 0x8000},
+            {0xFE02, 0xFFFF},
+        },
+    },
+};
+
+enum
+{
+    CASE_COUNT = sizeof(cases) / sizeof(cases[0])
+};
+
+// Memory the case should end with
+_Thread_local uint16_t expected[UINT16_MAX + 1];
+
+int verbose;
+
+void put_words(uint16_t *mem, const struct word *words)
+{
+    // The lists end at the first zero entry, x0000 may still be given a value
+    for (int i = 0; i < MEM_MAX && (words[i].addr || words[i].value); i++)
+        mem[words[i].addr] = words[i].value;
+}
+
+void report(const struct test_case *t, const struct engine *e, const char *what)
+{
+    printf("FAIL %s (%s): %s\n", t->name, e->name, what);
+    for (int i = 0; i < CODE_MAX && t->code[i]; i++)
+    {
+        char line[64];
+        disassemble(0x3000 + i, t->code[i], line, sizeof(line));
+        printf("     x%04X  %04X  %s\n", 0x3000 + i, t->code[i], line);
+    }
+}
+
+int run_case(const struct test_case *t, const struct engine *e)
+{
+    static const char *names[R_COUNT] = {"R0", "R1", "R2", "R3", "R4", "R5", "R6", "R7", "PC", "COND"};
+    static const int statuses[] = {[STOP_BUDGET] = VM_BUDGET, [STOP_HALT] = VM_HALTED, [STOP_ILLEGAL] = VM_ILLEGAL};
+    char what[128];
+
+    vm_reset();
+    memcpy(memory + 0x3000, t->code, sizeof(t->code));
+    put_words(memory, t->mem);
+    memcpy(registers, t->in, sizeof(t->in));
+    memcpy(expected, memory, sizeof(expected));
+    put_words(expected, t->expect);
+
+    const char *input = t->input ? t->input : "";
+    console_input_buffer((const uint8_t *)input, strlen(input));
+    console_output_buffer();
+    instr_budget = t->steps;
+    stop_reports = 0;
+
+    int status = e->run();
+
+    size_t len;
+    const uint8_t *out = console_output(&len);
+    const char *output = t->output ? t->output : "";
+    int passed = 0;
+
+    if (status != statuses[t->stop])
+    {
+        snprintf(what, sizeof(what), "stopped with status %d, expected %d", status, statuses[t->stop]);
+    }
+    else if (instret != (uint64_t)t->steps)
+    {
+        snprintf(what, sizeof(what), "%llu instructions, expected %d", (unsigned long long)instret, t->steps);
+    }
+    else if (len != strlen(output) || memcmp(out, output, len) != 0)
+    {
+        snprintf(what, sizeof(what), "output \"%.*s\", expected \"%s\"", (int)len, out, output);
+    }
+    else
+    {
+        passed = 1;
+        for (int r = 0; r < R_COUNT && passed; r++)
+        {
+            if (registers[r] != t->out[r])
+            {
+                snprintf(what, sizeof(what), "%s is x%04X, expected x%04X", names[r], registers[r], t->out[r]);
+                passed = 0;
+            }
+        }
+        for (uint32_t addr = 0; addr <= UINT16_MAX && passed; addr++)
+        {
+            if (memory[addr] != expected[addr])
+            {
+                snprintf(what, sizeof(what), "mem[x%04X] is x%04X, expected x%04X", addr, memory[addr],
+                         expected[addr]);
+                passed = 0;
+            }
+        }
+    }
+    console_close();
+
+    if (!passed)
+        report(t, e, what);
+    else if (verbose)
+        printf("ok   %s (%s)\n", t->name, e->name);
+    return passed;
+}
+
+int main(int argc, const char *argv[])
+{
+    const char *only[CASE_COUNT];
+    int only_count = 0;
+
+    for (int j = 1; j < argc; j++)
+    {
+        if (strcmp(argv[j], "-v") == 0)
+        {
+            verbose = 1;
+        }
+        else if (argv[j][0] != '-' && only_count < CASE_COUNT)
+        {
+            only[only_count++] = argv[j];
+        }
+        else
+        {
+            printf("conformance [-v] [case ..]\n");
+            exit(2);
+        }
+    }
+
+    int run = 0, failed = 0;
+    for (int i = 0; i < CASE_COUNT; i++)
+    {
+        int selected = only_count == 0;
+        for (int k = 0; k < only_count; k++)
+            selected |= strcmp(only[k], cases[i].name) == 0;
+        if (!selected)
+            continue;
+
+        for (int e = 0; e < ENGINE_COUNT; e++)
+        {
+            run++;
+            failed += !run_case(&cases[i], &engines[e]);
+        }
+    }
+
+    printf("%d of %d conformance runs passed\n", run - failed, run);
+    return failed != 0;
+}
@@ -0,0 +1,101 @@
+// Attach to the console rings of a running lc3 VM
+//
+//   lc3ring NAME     copy the output ring NAME to stdout until the VM exits
+//   lc3ring -w NAME  copy stdin into the input ring NAME
+//
+// Build with: cc -O2 -o lc3ring tools/lc3ring.c
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/ring.h"
+
+int read_ring(const char *name)
+{
+    struct ring *r = ring_open(name, 0);
+    if (!r)
+    {
+        printf("failed to open ring: %s\n", name);
+        return 2;
+    }
+
+    uint32_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    for (;;)
+    {
+        int closed = __atomic_load_n(&r->closed, __ATOMIC_ACQUIRE);
+        uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        if (head == tail)
+        {
+            if (closed)
+                break;
+            ring_wait(r, tail);
+            continue;
+        }
+
+        // Write straight from the shared data, at most up to the wrap point
+        uint32_t at = tail & (r->size - 1);
+        uint32_t n = head - tail;
+        if (n > r->size - at)
+            n = r->size - at;
+        ssize_t done = write(STDOUT_FILENO, r->data + at, n);
+        if (done <= 0)
+            return 1;
+
+        tail += done;
+        __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+    }
+
+    if (r->dropped)
+        fprintf(stderr, "lc3ring: %llu bytes dropped\n", (unsigned long long)r->dropped);
+
+    // The VM is gone, nobody else needs the segment
+    ring_close(r);
+    ring_unlink(name);
+    return 0;
+}
+
+int write_ring(const char *name)
+{
+    struct ring *r = ring_open(name, 0);
+    if (!r)
+    {
+        printf("failed to open ring: %s\n", name);
+        return 2;
+    }
+    ring_unlink(name);
+
+    uint8_t buf[4096];
+    uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    ssize_t n;
+    while ((n = read(STDIN_FILENO, buf, sizeof(buf))) > 0)
+    {
+        for (ssize_t i = 0; i < n; i++)
+        {
+            // The VM never wakes producers, so back off while the ring is full
+            while (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == r->size)
+            {
+                ring_publish(r, head);
+                nanosleep(&(struct timespec){.tv_nsec = 1000000}, NULL);
+            }
+            r->data[head & (r->size - 1)] = buf[i];
+            head++;
+        }
+        ring_publish(r, head);
+    }
+
+    ring_finish(r, head);
+    ring_close(r);
+    return 0;
+}
+
+int main(int argc, const char *argv[])
+{
+    if (argc == 2)
+        return read_ring(argv[1]);
+    if (argc == 3 && strcmp(argv[1], "-w") == 0)
+        return write_ring(argv[2]);
+
+    printf("lc3ring [-w] name\n");
+    return 2;
+}
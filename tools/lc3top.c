@@ -0,0 +1,65 @@
+// Watch the live counters of a VM started with --stats-shm NAME
+//
+//   lc3top NAME [interval-ms]
+//
+// Prints one line per interval until the VM exits.
+// Build with: cc -O2 -o lc3top tools/lc3top.c
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+
+#include "../src/stats.h"
+
+int main(int argc, const char *argv[])
+{
+    if (argc != 2 && argc != 3)
+    {
+        printf("lc3top name [interval-ms]\n");
+        return 2;
+    }
+
+    struct stats_shm *s = stats_open(argv[1], 0);
+    if (!s)
+    {
+        printf("failed to open stats: %s\n", argv[1]);
+        return 2;
+    }
+
+    long interval_ms = argc == 3 ? atol(argv[2]) : 1000;
+    if (interval_ms <= 0)
+        interval_ms = 1000;
+
+    struct stats_shm prev, now;
+    stats_read(s, &prev);
+    printf("%10s %16s %10s %12s %6s %6s %6s\n", "seconds", "instructions", "MIPS", "traps", "pc", "jobs", "queue");
+    for (;;)
+    {
+        nanosleep(&(struct timespec){.tv_sec = interval_ms / 1000, .tv_nsec = interval_ms % 1000 * 1000000L}, NULL);
+        stats_read(s, &now);
+
+        // MIPS over the last interval, from the VM's own update times
+        double dt = (now.update_ns - prev.update_ns) / 1e9;
+        double mips = dt > 0 ? (now.instret - prev.instret) / dt / 1e6 : 0.0;
+        double seconds = now.start_ns ? (now.update_ns - now.start_ns) / 1e9 : 0.0;
+        printf("%10.1f %16llu %10.2f %12llu  x%04X %6llu %6llu\n", seconds, (unsigned long long)now.instret, mips,
+               (unsigned long long)now.traps, now.pc, (unsigned long long)now.jobs_completed,
+               (unsigned long long)now.queue_depth);
+        fflush(stdout);
+
+        if (now.state == STATS_EXITED)
+            break;
+
+        // Killed VMs never publish STATS_EXITED
+        if (kill(now.pid, 0) < 0 && errno == ESRCH)
+        {
+            printf("lc3top: pid %u is gone\n", now.pid);
+            stats_unlink(argv[1]);
+            break;
+        }
+        prev = now;
+    }
+    return 0;
+}
@@ -0,0 +1,120 @@
+// Convert an lc3 execution trace (--trace) to text, one executed instruction per line
+//
+//   lc3trace FILE
+//
+// Build with: cc -O2 -o lc3trace tools/lc3trace.c
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../src/disasm.h"
+#include "../src/trace.h"
+
+uint16_t last_insn[UINT16_MAX + 1];
+
+int read_varint(FILE *file, uint32_t *v)
+{
+    *v = 0;
+    for (int shift = 0; shift < 32; shift += 7)
+    {
+        int c = getc_unlocked(file);
+        if (c == EOF)
+            return 0;
+        *v |= (uint32_t)(c & 0x7F) << shift;
+        if (!(c & 0x80))
+            return 1;
+    }
+    return 0;
+}
+
+void print_record(uint16_t pc, uint16_t insn, int has_mem, uint16_t addr, uint16_t value)
+{
+    char text[64];
+    disassemble(pc, insn, text, sizeof(text));
+
+    if (!has_mem)
+    {
+        printf("x%04X  x%04X  %s\n", pc, insn, text);
+        return;
+    }
+
+    // ST, STR and STI store, the other opcodes with an access load
+    int op = insn >> 12;
+    int store = op == 0x3 || op == 0x7 || op == 0xB;
+    printf("x%04X  x%04X  %-24s [x%04X] %s x%04X\n", pc, insn, text, addr, store ? "<-" : "->", value);
+}
+
+int main(int argc, const char *argv[])
+{
+    if (argc != 2)
+    {
+        printf("lc3trace trace-file\n");
+        return 2;
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    char magic[8];
+    if (!file || fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, TRACE_MAGIC, 8) != 0)
+    {
+        printf("not an lc3 trace: %s\n", argv[1]);
+        return 2;
+    }
+
+    uint16_t prev_pc = 0;
+    uint16_t prev_addr = 0;
+    uint64_t records = 0;
+    int tag;
+    while ((tag = getc_unlocked(file)) != EOF)
+    {
+        if (tag & TRACE_RUN)
+        {
+            for (int i = 0; i <= (tag & ~TRACE_RUN); i++)
+            {
+                prev_pc++;
+                print_record(prev_pc, last_insn[prev_pc], 0, 0, 0);
+                records++;
+            }
+            continue;
+        }
+
+        uint32_t v = 0;
+        uint16_t pc = prev_pc + 1;
+        uint16_t addr = 0;
+        uint16_t value = 0;
+        if (tag & TRACE_PC)
+        {
+            if (!read_varint(file, &v))
+                break;
+            pc += trace_unzigzag(v);
+        }
+        if (tag & TRACE_INSN)
+        {
+            int lo = getc_unlocked(file);
+            int hi = getc_unlocked(file);
+            if (hi == EOF)
+                break;
+            last_insn[pc] = lo | hi << 8;
+        }
+        if (tag & TRACE_MEM)
+        {
+            if (!read_varint(file, &v))
+                break;
+            addr = prev_addr + trace_unzigzag(v);
+            if (!read_varint(file, &v))
+                break;
+            value = v;
+            prev_addr = addr;
+        }
+
+        print_record(pc, last_insn[pc], (tag & TRACE_MEM) != 0, addr, value);
+        prev_pc = pc;
+        records++;
+    }
+
+    if (!feof(file))
+    {
+        fprintf(stderr, "lc3trace: truncated record after %llu instructions\n", (unsigned long long)records);
+        return 1;
+    }
+    return 0;
+}